@@ -36,7 +36,11 @@ LOG_MODULE_REGISTER(bu9795, CONFIG_BU9795_LOG_LEVEL);
 
 #define BU9795_ADDRESS_MASK 0x1F
 
+// Each display RAM address holds 4 bits (one SEG pin across COM0-3), so a byte spans two addresses.
+#define BU9795_ADDRESS_PER_BYTE 2
+
 #define BU9795_DISPLAY_FREQ_MASK    (BIT(4) | BIT(3))
+#define BU9795_DISPLAY_FREQ_SHIFT   3
 #define BU9795_DISPLAY_FREQ_80      0x00
 #define BU9795_DISPLAY_FREQ_71      0x08
 #define BU9795_DISPLAY_FREQ_64      0x10
@@ -73,18 +77,28 @@ LOG_MODULE_REGISTER(bu9795, CONFIG_BU9795_LOG_LEVEL);
 #define BU9795_ALL_PIXELS_OFF   0x01
 
 
-// TODO: Figure out a good way to configure the mappings in zephyr for a per-application project.
-#define SEGMENTS 7
-#define SYMBOLS 6
+// Sparse segment tables, generated at build time from the LCD wiring description
+#include <bu9795_segment_map.h>
+
+struct bu9795_segment {
+    // Number of register bytes this segment uses
+    u8_t count;
+    // Register bytes this segment uses
+    u8_t offset[BU9795_SEGMENT_MAX_BYTES];
+    // Bits owned by this segment within each register byte
+    u8_t mask[BU9795_SEGMENT_MAX_BYTES];
+    // Bits lit for each glyph within each register byte
+    u8_t glyphs[BU9795_SEGMENT_GLYPHS][BU9795_SEGMENT_MAX_BYTES];
+};
 
-struct  bu9795_segment {
-    u8_t mask[BU9795_SEG_REGISTER_SIZE];
-    u8_t digits[10][BU9795_SEG_REGISTER_SIZE];
+struct bu9795_symbol {
+    u8_t offset;
+    u8_t mask;
 };
 
 struct bu9795_segment_map {
-    struct bu9795_segment segments[SEGMENTS];
-    struct bu9795_segment symbols;
+    const struct bu9795_segment *segments;
+    const struct bu9795_symbol *symbols;
 };
 
 struct bu9795_data {
@@ -94,6 +108,37 @@ struct bu9795_data {
 
     // Local copy of seg register
     u8_t data[BU9795_SEG_REGISTER_SIZE];
+
+    // Copy of what the BU9795 last received, used to only send the bytes that changed.
+    // This is also the transmit buffer, so data can be changed while a transfer is in progress.
+    u8_t shadow[BU9795_SEG_REGISTER_SIZE];
+    bool shadow_valid;
+
+    // Flushes are deferred while a frame is open or the display is off
+    u8_t frame_depth;
+    bool flush_pending;
+    // A deferred flush was requested by a caller that waits for it
+    bool flush_pending_wait;
+
+#ifdef CONFIG_BU9795_ASYNC
+    // Segment data transfer that may still be in progress
+    struct k_poll_signal tx_signal;
+    bool tx_busy;
+    u8_t tx_command;
+    struct spi_buf tx_bufs[2];
+    struct spi_buf_set tx;
+#endif
+
+    // Display settings requested through the API
+    enum bu9795_frame_rate frame_rate;
+    enum bu9795_power_mode power_mode;
+    bool enabled;
+
+#ifdef CONFIG_DEVICE_POWER_MANAGEMENT
+    u32_t pm_state;
+#endif
+
+    struct bu9795_stats stats;
 };
 
 struct bu9795_config {
@@ -104,6 +149,7 @@ struct bu9795_config {
     struct spi_config spi_cfg;
 
     const u8_t segments;
+    const u8_t symbols;
     const struct bu9795_segment_map *segment_mapping;
 };
 
@@ -142,6 +188,39 @@ static uint8_t bu9795_set_all_pixels(uint8_t state){
         | (state & BU9795_ALL_PIXELS_MASK);
 }
 
+// Waits for an asynchronous segment data transfer to finish, returning its result.
+static int bu9795_wait(struct device *dev, s32_t timeout)
+{
+#ifdef CONFIG_BU9795_ASYNC
+    struct bu9795_data *data = dev->driver_data;
+    struct k_poll_event event;
+    unsigned int signaled;
+    int result;
+    int err;
+
+    if (!data->tx_busy) {
+        return 0;
+    }
+
+    k_poll_event_init(&event, K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &data->tx_signal);
+    err = k_poll(&event, 1, timeout);
+    if (err) {
+        return err;
+    }
+
+    k_poll_signal_check(&data->tx_signal, &signaled, &result);
+    data->tx_busy = false;
+
+    if (result) {
+        LOG_ERR("Failed to write segment data BU9795: SPI error '%d'", result);
+        // We no longer know what the BU9795 holds, resend everything next time.
+        data->shadow_valid = false;
+        return result;
+    }
+#endif
+    return 0;
+}
+
 static int bu9795_write_commands(struct device *dev, uint8_t *commands, uint8_t length) {
     struct bu9795_data *data = dev->driver_data;
     const struct bu9795_config *config = dev->config->config_info;
@@ -149,6 +228,9 @@ static int bu9795_write_commands(struct device *dev, uint8_t *commands, uint8_t
     struct spi_buf_set tx;
     int err;
 
+    // Commands must not be interleaved with a segment data transfer
+    bu9795_wait(dev, K_FOREVER);
+
     for(int i = 0; i < length; i++)
         commands[i] |= BU9795_CMD_DATA_BIT;
 
@@ -162,20 +244,44 @@ static int bu9795_write_commands(struct device *dev, uint8_t *commands, uint8_t
     tx.count = 1;
 
     err = spi_write(data->spi_dev, &config->spi_cfg, &tx);
+    if (!err) {
+        data->stats.bytes_sent += length;
+    }
 
     return err;
 }
 
-static int bu9795_write_data(struct device *dev, u8_t addr, const u8_t *payload, u8_t len)
+static int bu9795_write_data(struct device *dev, u8_t addr, const u8_t *payload, u8_t len, bool async)
 {
     struct bu9795_data *data = dev->driver_data;
     const struct bu9795_config *config = dev->config->config_info;
+    int err;
 
     // TODO: set the MSB bit
 
     u8_t command = bu9795_set_address(addr) & ~BU9795_CMD_DATA_BIT;
 
     LOG_DBG("Set address command: 0x%02X", command);
+    LOG_HEXDUMP_DBG(payload, len, "Writing payload to BU9795");
+
+#ifdef CONFIG_BU9795_ASYNC
+    if (async) {
+        // The buffers have to outlive this call
+        data->tx_command = command;
+        data->tx_bufs[0] = (struct spi_buf){ .buf = &data->tx_command, .len = 1 };
+        data->tx_bufs[1] = (struct spi_buf){ .buf = (void*)payload, .len = len };
+        data->tx = (struct spi_buf_set){ .buffers = data->tx_bufs, .count = 2 };
+
+        k_poll_signal_reset(&data->tx_signal);
+        err = spi_write_async(data->spi_dev, &config->spi_cfg, &data->tx, &data->tx_signal);
+        if (!err) {
+            data->tx_busy = true;
+            data->stats.bytes_sent += 1 + len;
+        }
+
+        return err;
+    }
+#endif
 
     struct spi_buf tx_buf[] = {
         { .buf = &command, .len = 1},
@@ -186,15 +292,204 @@ static int bu9795_write_data(struct device *dev, u8_t addr, const u8_t *payload,
         .count = 2,
     };
 
-    LOG_HEXDUMP_DBG(payload, len, "Writing payload to BU9795");
+    err = spi_write(data->spi_dev, &config->spi_cfg, &tx);
+    if (!err) {
+        data->stats.bytes_sent += 1 + len;
+    }
+
+    return err;
+}
+
+// Sends only the range of bytes that differ from what the BU9795 last received.
+// With async set, the transfer is only started and bu9795_wait() reports its result.
+static int bu9795_sync(struct device *dev, bool async)
+{
+    struct bu9795_data *data = dev->driver_data;
+    int first = 0;
+    int last = BU9795_SEG_REGISTER_SIZE - 1;
+    int err;
+
+    // The shadow copy is the transmit buffer, it can't change until the previous transfer is done
+    bu9795_wait(dev, K_FOREVER);
+
+    data->stats.flushes++;
+
+    if (data->shadow_valid) {
+        while (first <= last && data->data[first] == data->shadow[first]) {
+            first++;
+        }
+
+        if (first > last) {
+            data->stats.flushes_skipped++;
+            return 0;
+        }
+
+        while (data->data[last] == data->shadow[last]) {
+            last--;
+        }
+    }
 
-    return spi_write(data->spi_dev, &config->spi_cfg, &tx);
+    LOG_DBG("Flushing bytes %d-%d", first, last);
+
+    memcpy(&data->shadow[first], &data->data[first], last - first + 1);
+    data->shadow_valid = true;
+
+    err = bu9795_write_data(dev, first * BU9795_ADDRESS_PER_BYTE, &data->shadow[first], last - first + 1, async);
+    if (err) {
+        // We no longer know what the BU9795 holds, resend everything next time.
+        data->shadow_valid = false;
+        return err;
+    }
+
+    return 0;
+}
+
+// Whether the LCD is currently driven, taking device power management into account
+static bool bu9795_visible(struct bu9795_data *data)
+{
+#ifdef CONFIG_DEVICE_POWER_MANAGEMENT
+    if (data->pm_state != DEVICE_PM_ACTIVE_STATE && data->pm_state != DEVICE_PM_LOW_POWER_STATE) {
+        return false;
+    }
+#endif
+    return data->enabled;
+}
+
+// Sends the display control and mode commands matching the current settings.
+static int bu9795_update_control(struct device *dev)
+{
+    struct bu9795_data *data = dev->driver_data;
+    enum bu9795_frame_rate frame_rate = data->frame_rate;
+    enum bu9795_power_mode power_mode = data->power_mode;
+    bool visible = bu9795_visible(data);
+    int err;
+
+#ifdef CONFIG_DEVICE_POWER_MANAGEMENT
+    if (data->pm_state == DEVICE_PM_LOW_POWER_STATE) {
+        frame_rate = BU9795_FRAME_RATE_53HZ;
+        power_mode = BU9795_POWER_SAVE_1;
+    }
+#endif
+
+    // Bring the segment register up to date before the display is turned back on
+    if (visible && data->flush_pending && data->frame_depth == 0) {
+        err = bu9795_sync(dev, false);
+        if (err) {
+            return err;
+        }
+        data->flush_pending = false;
+        data->flush_pending_wait = false;
+    }
+
+    u8_t commands[] = {
+        bu9795_set_display_control(frame_rate << BU9795_DISPLAY_FREQ_SHIFT, BU9795_DISPLAY_WAVEFORM_FRAME, power_mode),
+        bu9795_set_mode(visible ? DISPLAY_ON : DISPLAY_OFF, DISPLAY_BIAS_LEVEL_1_3),
+    };
+
+    LOG_DBG("Display %s, frame rate %d, power mode %d", visible ? "on" : "off", frame_rate, power_mode);
+
+    return bu9795_write_commands(dev, commands, ARRAY_SIZE(commands));
+}
+
+static int bu9795_request_flush(struct device *dev, bool wait)
+{
+    struct bu9795_data *data = dev->driver_data;
+    int err;
+
+    if (data->frame_depth > 0 || !bu9795_visible(data)) {
+        data->flush_pending = true;
+        data->flush_pending_wait |= wait;
+        return 0;
+    }
+
+    err = bu9795_sync(dev, !wait);
+    if (!err && wait) {
+        err = bu9795_wait(dev, K_FOREVER);
+    }
+
+    return err;
 }
 
 static void flush_impl(struct device *dev)
+{
+    int err = bu9795_request_flush(dev, true);
+
+    if (err) {
+        LOG_ERR("Failed to write segment data BU9795: SPI error '%d'", err);
+    }
+}
+
+static int flush_async_impl(struct device *dev)
+{
+    return bu9795_request_flush(dev, !IS_ENABLED(CONFIG_BU9795_ASYNC));
+}
+
+static int flush_wait_impl(struct device *dev, s32_t timeout)
+{
+    return bu9795_wait(dev, timeout);
+}
+
+static void begin_frame_impl(struct device *dev)
 {
     struct bu9795_data *data = dev->driver_data;
-    bu9795_write_data(dev, 0, data->data, BU9795_SEG_REGISTER_SIZE);
+
+    data->frame_depth++;
+}
+
+static void commit_frame_impl(struct device *dev)
+{
+    struct bu9795_data *data = dev->driver_data;
+
+    if (data->frame_depth == 0) {
+        LOG_WRN("Committing a frame that was never started");
+        return;
+    }
+
+    if (--data->frame_depth == 0 && data->flush_pending) {
+        bool wait = data->flush_pending_wait;
+
+        data->flush_pending = false;
+        data->flush_pending_wait = false;
+
+        int err = bu9795_request_flush(dev, wait || !IS_ENABLED(CONFIG_BU9795_ASYNC));
+        if (err) {
+            LOG_ERR("Failed to write segment data BU9795: SPI error '%d'", err);
+        }
+    }
+}
+
+static int set_drive_mode_impl(struct device *dev, enum bu9795_frame_rate rate, enum bu9795_power_mode mode)
+{
+    struct bu9795_data *data = dev->driver_data;
+
+    if (rate > BU9795_FRAME_RATE_53HZ || mode > BU9795_POWER_HIGH) {
+        return -EINVAL;
+    }
+
+    data->frame_rate = rate;
+    data->power_mode = mode;
+
+    return bu9795_update_control(dev);
+}
+
+static int set_display_enabled_impl(struct device *dev, bool enabled)
+{
+    struct bu9795_data *data = dev->driver_data;
+
+    if (data->enabled == enabled) {
+        return 0;
+    }
+
+    data->enabled = enabled;
+
+    return bu9795_update_control(dev);
+}
+
+static void get_stats_impl(struct device *dev, struct bu9795_stats *stats)
+{
+    struct bu9795_data *data = dev->driver_data;
+
+    *stats = data->stats;
 }
 
 static int bu9795_init(struct device *dev)
@@ -230,7 +525,6 @@ static int bu9795_init(struct device *dev)
     u8_t init_commands[] = {
         bu9795_reset(),
         bu9795_set_blick_rate(BU9795_BLINK_RATE_OFF),
-        bu9795_set_display_control(BU9795_DISPLAY_FREQ_80, BU9795_DISPLAY_WAVEFORM_FRAME, BU9795_DISPLAY_POWER_NORMAL),
         bu9795_set_ic(BU9795_IC_MSB_0, BU9795_IC_CLOCK_INTERMAL),
     };
 
@@ -241,15 +535,27 @@ static int bu9795_init(struct device *dev)
         return err;
     }
 
-    flush_impl(dev);
+#ifdef CONFIG_BU9795_ASYNC
+    k_poll_signal_init(&data->tx_signal);
+#endif
+
+    // The BU9795 was just reset, so the whole register needs to be written.
+    data->shadow_valid = false;
+    err = bu9795_sync(dev, false);
 
     if(err){
         LOG_ERR("Failed to write segment data BU9795: SPI error '%d'", err);
         return err;
     }
 
-    u8_t display_command = bu9795_set_mode(DISPLAY_ON, DISPLAY_BIAS_LEVEL_1_3);
-    err = bu9795_write_commands(dev, &display_command, 1);
+    data->frame_rate = BU9795_FRAME_RATE_80HZ;
+    data->power_mode = BU9795_POWER_NORMAL;
+    data->enabled = true;
+#ifdef CONFIG_DEVICE_POWER_MANAGEMENT
+    data->pm_state = DEVICE_PM_ACTIVE_STATE;
+#endif
+
+    err = bu9795_update_control(dev);
 
     if(err){
         LOG_ERR("Failed to turn display on BU9795: SPI error '%d'", err);
@@ -272,55 +578,52 @@ static void set_segment_impl(struct device *dev, int segment, int value)
 {
     const struct bu9795_config *config = dev->config->config_info;
     struct bu9795_data *data = dev->driver_data;
-    // TODO: setup a mapping (or lookup table) fromBU9795's seg0...30 to the desired segment and value.
+
     if (segment >= config->segments)
     {
         LOG_ERR("Segment %d is out of range 0-%d", segment, config->segments - 1);
         return;
     }
 
-    if (value >= 10)
+    if (value >= BU9795_SEGMENT_GLYPHS)
     {
         LOG_ERR("Cannot display %d for segment %d", value, segment);
         return;
     }
 
     const struct bu9795_segment *mapping = &config->segment_mapping->segments[segment];
-    for(int i = 0; i < BU9795_SEG_REGISTER_SIZE; i++)
+    for(int i = 0; i < mapping->count; i++)
     {
-        data->data[i] &= mapping->mask[i];
+        u8_t *reg = &data->data[mapping->offset[i]];
+
+        *reg &= ~mapping->mask[i];
         if(value >= 0) {
-            data->data[i] |= mapping->digits[value][i];
+            *reg |= mapping->glyphs[value][i];
         }
     }
-
-    // bu9795_flush(dev);
 }
 
 static void set_symbol_impl(struct device *dev, u32_t symbols)
 {
     const struct bu9795_config *config = dev->config->config_info;
     struct bu9795_data *data = dev->driver_data;
-    // TODO: setup a mapping (or lookup table) fromBU9795's seg0...30 to the desired segment and value.
-    if (symbols & ~BIT_MASK(SYMBOLS))
+
+    if (symbols & ~BIT_MASK(config->symbols))
     {
-        LOG_ERR("Symbol bitmap 0x%04X is out of range 0x%04X", symbols, (u32_t)BIT_MASK(SYMBOLS));
+        LOG_ERR("Symbol bitmap 0x%04X is out of range 0x%04X", symbols, (u32_t)BIT_MASK(config->symbols));
         return;
     }
 
-    const struct bu9795_segment *mapping = &config->segment_mapping->symbols;
-    for(int i = 0; i < BU9795_SEG_REGISTER_SIZE; i++)
+    for(int symbol = 0; symbol < config->symbols; symbol++)
     {
-        data->data[i] &= mapping->mask[i];
+        const struct bu9795_symbol *mapping = &config->segment_mapping->symbols[symbol];
 
-        for(int symbol = 0; symbol < SYMBOLS; symbol++) {
-            if (BIT(symbol) & symbols) {
-                data->data[i] |= mapping->digits[symbol][i];
-            }
+        if (BIT(symbol) & symbols) {
+            data->data[mapping->offset] |= mapping->mask;
+        } else {
+            data->data[mapping->offset] &= ~mapping->mask;
         }
     }
-
-    // bu9795_flush(dev);
 }
 
 #if CONFIG_BU9795_TEST_PATTERN
@@ -360,11 +663,50 @@ static void set_test_pattern_impl(struct device *dev, int stage)
 }
 #endif
 
+#ifdef CONFIG_DEVICE_POWER_MANAGEMENT
+static int bu9795_pm_control(struct device *dev, u32_t ctrl_command, void *context, device_pm_cb cb, void *arg)
+{
+    struct bu9795_data *data = dev->driver_data;
+    int err = 0;
+
+    if (ctrl_command == DEVICE_PM_SET_POWER_STATE) {
+        u32_t new_state = *((const u32_t *)context);
+
+        if (new_state != data->pm_state) {
+            u32_t old_state = data->pm_state;
+
+            // Low power keeps the display on at the lowest drive, any deeper state turns it off.
+            // The segment register is retained, so resuming only needs the display turned back on.
+            data->pm_state = new_state;
+            err = bu9795_update_control(dev);
+            if (err) {
+                data->pm_state = old_state;
+            }
+        }
+    } else {
+        *((u32_t *)context) = data->pm_state;
+    }
+
+    if (cb) {
+        cb(dev, err, context, arg);
+    }
+
+    return err;
+}
+#endif
+
 static const struct bu9795_driver_api bu9795_driver_api_impl = {
     .clear = &clear_impl,
     .set_segment = &set_segment_impl,
     .set_symbol = &set_symbol_impl,
     .flush = &flush_impl,
+    .flush_async = &flush_async_impl,
+    .flush_wait = &flush_wait_impl,
+    .get_stats = &get_stats_impl,
+    .begin_frame = &begin_frame_impl,
+    .commit_frame = &commit_frame_impl,
+    .set_drive_mode = &set_drive_mode_impl,
+    .set_display_enabled = &set_display_enabled_impl,
 #if CONFIG_BU9795_TEST_PATTERN
     .set_test_pattern = &set_test_pattern_impl,
 #endif
@@ -373,126 +715,12 @@ static const struct bu9795_driver_api bu9795_driver_api_impl = {
 // TODO: Somehow generate the following for each instance of BU97975
 #if DT_INST_0_ROHM_BU9795
 
-// TODO: Generate this mapping somehow
-const struct bu9795_segment_map bu9795_segment_map_0 = {
-    .segments = {
-        {
-            .mask = {0xff, 0xff, 0xf8, 0x00, 0x3f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff},
-            .digits = {
-                {0x00, 0x00, 0x07, 0xdf, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x07, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x07, 0xbd, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x05, 0xbf, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x04, 0xe7, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x05, 0xff, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x07, 0xff, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x8f, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x07, 0xff, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x04, 0xef, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-            }
-        },
-        {
-            .mask = {0xFF, 0xFF, 0xFF, 0xFF, 0xC0, 0x03, 0x7F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
-            .digits = {
-                {0x00, 0x00, 0x00, 0x00, 0x3D, 0xFC, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x74, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x37, 0xDC, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x17, 0xFC, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x0E, 0xF4, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x1F, 0xF8, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x3F, 0xF8, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0xFC, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x3F, 0xFC, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x0E, 0xFC, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-            },
-        },
-        {
-            .mask = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE, 0x80, 0x0B, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
-            .digits = {
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x7D, 0xF4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xF4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x3F, 0xD4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x2F, 0xF4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x6A, 0xF4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x6F, 0x74, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x7F, 0x74, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0xF4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x7F, 0xF4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x6E, 0xF4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-            },
-        },
-        {
-            .mask = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x80, 0x03, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
-            .digits = {
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7D, 0xFC, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7C, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7B, 0xDC, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x5B, 0xFC, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4E, 0x7C, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x5F, 0xF8, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7F, 0xF8, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0xFC, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7F, 0xFC, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4E, 0xFC, 0x00, 0x00, 0x00, 0x00, 0x00},
-            },
-        },
-        {
-            .mask = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFC, 0x00, 0x37, 0xFF, 0xFF, 0xFF},
-            .digits = {
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0xDF, 0xC8, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0x48, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x7D, 0xC8, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x7F, 0xC8, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xEF, 0x48, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0xFF, 0x88, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0xFF, 0x88, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0F, 0xC8, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0xFF, 0xC8, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xEF, 0xC8, 0x00, 0x00, 0x00},
-            },
-        },
-        {
-            .mask = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xE8, 0x00, 0xBF, 0xFF},
-            .digits = {
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x17, 0xDF, 0x40, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0F, 0x40, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x13, 0xFD, 0x40, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x12, 0xFF, 0x40, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x06, 0xAF, 0x40, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x16, 0xF7, 0x40, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x17, 0xF7, 0x40, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xCF, 0x40, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x17, 0xFF, 0x40, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x06, 0xEF, 0x40, 0x00},
-            },
-        },
-        {
-            .mask = {0xFF, 0xFF, 0x07, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x7F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
-            .digits = {
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x38, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x78, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0xF8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0xF8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-            },
-        },
-    },
-    .symbols = {
-        .mask = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFD, 0xFF, 0xF4, 0xFF, 0xFF, 0xFF, 0xDF, 0xFF, 0x7F, 0xFF},
-        .digits = {
-            {0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-            {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-            {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-            {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-            {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00},
-            {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x00},
-        },
-    },
+static const struct bu9795_segment bu9795_segments_0[] = BU9795_SEGMENTS_INIT;
+static const struct bu9795_symbol bu9795_symbols_0[] = BU9795_SYMBOLS_INIT;
+
+static const struct bu9795_segment_map bu9795_segment_map_0 = {
+    .segments = bu9795_segments_0,
+    .symbols = bu9795_symbols_0,
 };
 
 static struct bu9795_data bu9795_data_0 = {
@@ -511,13 +739,14 @@ static const struct bu9795_config bu9795_config_0 = {
         .cs = &bu9795_data_0.spi_cs,
     },
 
-    .segments = SEGMENTS,
+    .segments = BU9795_SEGMENT_COUNT,
+    .symbols = BU9795_SYMBOL_COUNT,
     .segment_mapping = &bu9795_segment_map_0,
 };
 
 
-DEVICE_AND_API_INIT(bu9795_0, DT_INST_0_ROHM_BU9795_LABEL,
-            bu9795_init, &bu9795_data_0, &bu9795_config_0,
+DEVICE_DEFINE(bu9795_0, DT_INST_0_ROHM_BU9795_LABEL,
+            bu9795_init, bu9795_pm_control, &bu9795_data_0, &bu9795_config_0,
             POST_KERNEL, CONFIG_APPLICATION_INIT_PRIORITY,
             &bu9795_driver_api_impl);
 
@@ -12,11 +12,43 @@ extern "C" {
 
 #include <device.h>
 
+/** LCD frame frequency */
+enum bu9795_frame_rate {
+	BU9795_FRAME_RATE_80HZ,
+	BU9795_FRAME_RATE_71HZ,
+	BU9795_FRAME_RATE_64HZ,
+	BU9795_FRAME_RATE_53HZ,
+};
+
+/** LCD drive power mode, from lowest to highest current draw */
+enum bu9795_power_mode {
+	BU9795_POWER_SAVE_1,
+	BU9795_POWER_SAVE_2,
+	BU9795_POWER_NORMAL,
+	BU9795_POWER_HIGH,
+};
+
+struct bu9795_stats {
+	// Total bytes (commands and segment data) written to the BU9795 over SPI
+	u32_t bytes_sent;
+	// Number of flush requests
+	u32_t flushes;
+	// Flush requests that didn't need a transfer because nothing changed
+	u32_t flushes_skipped;
+};
+
 struct bu9795_driver_api {
 	void (*clear)(struct device *dev);
 	void (*set_segment)(struct device *dev, int segment, int value);
 	void (*set_symbol)(struct device *dev, u32_t symbols);
 	void (*flush)(struct device *dev);
+	int (*flush_async)(struct device *dev);
+	int (*flush_wait)(struct device *dev, s32_t timeout);
+	void (*get_stats)(struct device *dev, struct bu9795_stats *stats);
+	void (*begin_frame)(struct device *dev);
+	void (*commit_frame)(struct device *dev);
+	int (*set_drive_mode)(struct device *dev, enum bu9795_frame_rate rate, enum bu9795_power_mode mode);
+	int (*set_display_enabled)(struct device *dev, bool enabled);
 #if CONFIG_BU9795_TEST_PATTERN
 	void (*set_test_pattern)(struct device *dev, int stage);
 #endif
@@ -45,6 +77,86 @@ static inline void bu9795_flush(struct device *dev)
 	const struct bu9795_driver_api *api = dev->driver_api;
 	api->flush(dev);
 }
+
+/**
+ * Start sending the segment register to the display without waiting for
+ * the transfer to finish. The segment register can be changed while the
+ * transfer is in progress. Use bu9795_flush_wait() to wait for the
+ * result, or don't to fire and forget.
+ *
+ * Without CONFIG_BU9795_ASYNC this behaves like bu9795_flush().
+ *
+ * @return zero if the transfer was started, or a negative error code.
+ */
+static inline int bu9795_flush_async(struct device *dev)
+{
+	const struct bu9795_driver_api *api = dev->driver_api;
+	return api->flush_async(dev);
+}
+
+/**
+ * Wait for a transfer started with bu9795_flush_async() to finish.
+ *
+ * @return zero on success, -EAGAIN if the timeout expired, or the
+ * negative error code of the transfer.
+ */
+static inline int bu9795_flush_wait(struct device *dev, s32_t timeout)
+{
+	const struct bu9795_driver_api *api = dev->driver_api;
+	return api->flush_wait(dev, timeout);
+}
+
+static inline void bu9795_get_stats(struct device *dev, struct bu9795_stats *stats)
+{
+	const struct bu9795_driver_api *api = dev->driver_api;
+	api->get_stats(dev, stats);
+}
+/**
+ * Start buffering updates. Flushes requested before the matching
+ * bu9795_commit_frame() are deferred and sent as a single transfer.
+ * Frames may be nested.
+ */
+static inline void bu9795_begin_frame(struct device *dev)
+{
+	const struct bu9795_driver_api *api = dev->driver_api;
+	api->begin_frame(dev);
+}
+
+/**
+ * End a frame started with bu9795_begin_frame(). Closing the outermost
+ * frame performs any flush that was deferred while it was open.
+ */
+static inline void bu9795_commit_frame(struct device *dev)
+{
+	const struct bu9795_driver_api *api = dev->driver_api;
+	api->commit_frame(dev);
+}
+
+/**
+ * Change the LCD frame frequency and drive power mode. Lower frame
+ * rates and power save modes reduce the current drawn by the LCD.
+ *
+ * @return zero on success, or a negative error code.
+ */
+static inline int bu9795_set_drive_mode(struct device *dev, enum bu9795_frame_rate rate,
+					enum bu9795_power_mode mode)
+{
+	const struct bu9795_driver_api *api = dev->driver_api;
+	return api->set_drive_mode(dev, rate, mode);
+}
+
+/**
+ * Turn the LCD on or off. The segment register is kept while the
+ * display is off, and flushes are deferred until it's turned back on.
+ *
+ * @return zero on success, or a negative error code.
+ */
+static inline int bu9795_set_display_enabled(struct device *dev, bool enabled)
+{
+	const struct bu9795_driver_api *api = dev->driver_api;
+	return api->set_display_enabled(dev, enabled);
+}
+
 #if CONFIG_BU9795_TEST_PATTERN
 static inline void bu9795_set_test_pattern(struct device *dev, int stage)
 {
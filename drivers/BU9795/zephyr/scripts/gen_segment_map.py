@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2019 Nordic Semiconductor
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""
+Generates the BU9795 segment tables from a YAML description of how an LCD
+is wired to the BU9795 display RAM.
+
+Rather than storing a full copy of the segment register for every glyph,
+each segment only records the register bytes it touches, the bits it owns
+in those bytes, and the bits to light for each glyph. Symbols are a single
+bit mask within one register byte.
+"""
+
+import argparse
+import os
+import sys
+
+import yaml
+
+# Size (in bytes) of the entire (including dummy) segment register on the BU9795.
+REGISTER_SIZE = 15
+# Glyphs 0-9 are the decimal digits, 10 is a minus sign on positions that can show one.
+MAX_GLYPHS = 11
+
+
+def error(msg):
+    sys.exit("error: {}".format(msg))
+
+
+def parse_bits(bits, what):
+    if not isinstance(bits, dict):
+        error("{}: expected a mapping of register byte to bit mask".format(what))
+
+    for offset, mask in bits.items():
+        if not isinstance(offset, int) or not 0 <= offset < REGISTER_SIZE:
+            error("{}: register byte {} is out of range 0-{}".format(what, offset, REGISTER_SIZE - 1))
+        if not isinstance(mask, int) or not 0 <= mask <= 0xFF:
+            error("{}: bit mask {} for byte {} is not a byte".format(what, mask, offset))
+
+    return {offset: mask for offset, mask in bits.items() if mask}
+
+
+def parse_segment(segment):
+    name = segment.get("name", "<unnamed>")
+    glyphs = segment.get("glyphs")
+
+    if not glyphs or len(glyphs) > MAX_GLYPHS:
+        error("segment {}: expected 1-{} glyphs".format(name, MAX_GLYPHS))
+
+    glyphs = [parse_bits(glyph, "segment {} glyph {}".format(name, i))
+              for i, glyph in enumerate(glyphs)]
+
+    # A segment owns every bit any of its glyphs light up
+    owned = {}
+    for glyph in glyphs:
+        for offset, mask in glyph.items():
+            owned[offset] = owned.get(offset, 0) | mask
+
+    return name, sorted(owned.items()), glyphs
+
+
+def parse_symbol(symbol):
+    name = symbol.get("name", "<unnamed>")
+    bits = parse_bits(symbol.get("bits"), "symbol {}".format(name))
+
+    if len(bits) != 1:
+        error("symbol {}: must use bits of exactly one register byte".format(name))
+
+    return name, next(iter(bits.items()))
+
+
+def check_overlaps(segments, symbols):
+    used = [0] * REGISTER_SIZE
+    users = [(name, owned) for name, owned, _ in segments]
+    users += [(name, [bits]) for name, bits in symbols]
+
+    for name, owned in users:
+        for offset, mask in owned:
+            if used[offset] & mask:
+                error("{} uses bits of register byte {} that are already taken".format(name, offset))
+            used[offset] |= mask
+
+
+def c_bytes(values):
+    return "{" + ", ".join("0x{:02x}".format(v) for v in values) + "}"
+
+
+def c_macro(name, lines):
+    # Multi-line initialiser macro, every line but the last needs a continuation
+    lines = ["#define {} {{".format(name)] + lines + ["}"]
+    return " \\\n".join(lines)
+
+
+def generate(segments, symbols, source):
+    max_bytes = max(len(owned) for _, owned, _ in segments)
+
+    out = []
+    out.append("/* Generated by gen_segment_map.py from {}, do not edit. */".format(source))
+    out.append("")
+    out.append("#define BU9795_SEGMENT_COUNT {}".format(len(segments)))
+    out.append("#define BU9795_SYMBOL_COUNT {}".format(len(symbols)))
+    out.append("#define BU9795_SEGMENT_MAX_BYTES {}".format(max_bytes))
+    out.append("#define BU9795_SEGMENT_GLYPHS {}".format(MAX_GLYPHS))
+    out.append("")
+    init = []
+    for name, owned, glyphs in segments:
+        offsets = [offset for offset, _ in owned]
+        pad = [0] * (max_bytes - len(owned))
+
+        init.append("    /* {} */".format(name))
+        init.append("    {")
+        init.append("        .count = {},".format(len(owned)))
+        init.append("        .offset = {{{}}},".format(", ".join(str(v) for v in offsets + pad)))
+        init.append("        .mask = {},".format(c_bytes([mask for _, mask in owned] + pad)))
+        init.append("        .glyphs = {")
+        for glyph in glyphs:
+            init.append("            {},".format(c_bytes([glyph.get(offset, 0) for offset in offsets] + pad)))
+        init.append("        },")
+        init.append("    },")
+    out.append(c_macro("BU9795_SEGMENTS_INIT", init))
+    out.append("")
+
+    init = []
+    for name, (offset, mask) in symbols:
+        init.append("    /* {} */".format(name))
+        init.append("    {{ .offset = {}, .mask = 0x{:02x} }},".format(offset, mask))
+    out.append(c_macro("BU9795_SYMBOLS_INIT", init))
+
+    return "\n".join(out) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--input", required=True, help="YAML description of the LCD wiring")
+    parser.add_argument("--output", required=True, help="Header file to generate")
+    args = parser.parse_args()
+
+    with open(args.input) as f:
+        wiring = yaml.safe_load(f)
+
+    segments = [parse_segment(segment) for segment in wiring.get("segments", [])]
+    symbols = [parse_symbol(symbol) for symbol in wiring.get("symbols", [])]
+
+    if not segments:
+        error("{}: no segments described".format(args.input))
+    if len(symbols) > 32:
+        error("{}: at most 32 symbols are supported".format(args.input))
+
+    check_overlaps(segments, symbols)
+
+    with open(args.output, "w") as f:
+        f.write(generate(segments, symbols, os.path.basename(args.input)))
+
+
+if __name__ == "__main__":
+    main()
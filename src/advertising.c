@@ -0,0 +1,501 @@
+#include <zephyr.h>
+#include <init.h>
+#include <sys/atomic.h>
+#include <sys/byteorder.h>
+#include <shell/shell.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(advertising, LOG_LEVEL_INF);
+
+#include "advertising.h"
+
+// Advertising is the largest share of the idle current, so it runs as a small state machine:
+//
+//   boot/disconnect (when bonded) -> RECONNECT --timeout--> SLOW
+//   boot/button/disconnect -> FAST --timeout--> SLOW --timeout (only when bonded)--> OFF
+//   connect (from any state) -> CONNECTED, or SLOW while there is room for another connection
+//
+// RECONNECT only lets bonded peers connect, so the gateways pick the device up again without the
+// button: with a single bond through high duty directed advertising, which connects within a few
+// milliseconds, otherwise (or once directed advertising times out) through fast advertising
+// filtered by the whitelist. Note that peers using resolvable private addresses aren't matched.
+//
+// All transitions run on the system work queue. With APP_BT_BROADCAST_NCONN the readings keep
+// being broadcast non-connectable while OFF or CONNECTED, and between connectable windows in SLOW.
+
+enum advertising_state {
+    ADVERTISING_OFF,
+    ADVERTISING_RECONNECT,
+    ADVERTISING_FAST,
+    ADVERTISING_SLOW,
+    ADVERTISING_CONNECTED,
+    ADVERTISING_STATE_COUNT,
+};
+
+static const char *const advertising_state_names[ADVERTISING_STATE_COUNT] = {
+    [ADVERTISING_OFF] = "off",
+    [ADVERTISING_RECONNECT] = "reconnect",
+    [ADVERTISING_FAST] = "fast",
+    [ADVERTISING_SLOW] = "slow",
+    [ADVERTISING_CONNECTED] = "connected",
+};
+
+#define ADVERTISING_EVENT_BOOT          0
+#define ADVERTISING_EVENT_BUTTON        1
+#define ADVERTISING_EVENT_CONNECTED     2
+#define ADVERTISING_EVENT_DISCONNECTED  3
+#define ADVERTISING_EVENT_DATA          4
+#define ADVERTISING_EVENT_DIRECTED_DONE 5
+
+#define ADVERTISING_CONN_FAST   BT_LE_ADV_CONN_NAME
+#define ADVERTISING_CONN_BONDED BT_LE_ADV_PARAM(BT_LE_ADV_OPT_CONNECTABLE | BT_LE_ADV_OPT_USE_NAME | \
+                                                BT_LE_ADV_OPT_FILTER_CONN, \
+                                                BT_GAP_ADV_FAST_INT_MIN_2, BT_GAP_ADV_FAST_INT_MAX_2)
+#define ADVERTISING_CONN_SLOW   BT_LE_ADV_PARAM(BT_LE_ADV_OPT_CONNECTABLE | BT_LE_ADV_OPT_USE_NAME, \
+                                                BT_GAP_ADV_SLOW_INT_MIN, BT_GAP_ADV_SLOW_INT_MAX)
+#define ADVERTISING_NCONN_SLOW  BT_LE_ADV_PARAM(BT_LE_ADV_OPT_NONE, \
+                                                BT_GAP_ADV_SLOW_INT_MIN, BT_GAP_ADV_SLOW_INT_MAX)
+
+// Readings broadcast as ESS service data, so gateways can collect them without connecting:
+// ESS UUID, temperature (s16, 0.01 degC), humidity (u16, 0.01 %RH), battery (u8, %) and a
+// counter (u8) that changes whenever the readings do. All little endian.
+#define BROADCAST_TEMPERATURE   2
+#define BROADCAST_HUMIDITY      4
+#define BROADCAST_BATTERY       6
+#define BROADCAST_COUNTER       7
+
+static u8_t broadcast_data[] = {
+    0x1a, 0x18, /* Environmental Sensing Service */
+    0x00, 0x00,
+    0x00, 0x00,
+    0x00,
+    0x00,
+};
+
+static const struct bt_data advertising_data[] = {
+    BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
+    BT_DATA_BYTES(BT_DATA_UUID16_ALL,
+                  0x1a, 0x18, /* Environmental Sensing Service */
+                  0x0a, 0x18, /* Device Information Service */
+                  0x0f, 0x18), /* Battery Service */
+#if CONFIG_APP_BT_BROADCAST
+    BT_DATA(BT_DATA_SVC_DATA16, broadcast_data, sizeof(broadcast_data)),
+#endif
+};
+
+// Latest readings handed over by advertising_update_broadcast()
+static struct measurement broadcast_next;
+static K_MUTEX_DEFINE(broadcast_lock);
+
+static atomic_t events;
+static atomic_t connection_count;
+static struct k_work event_work;
+static struct k_delayed_work timeout_work;
+
+static enum advertising_state state = ADVERTISING_OFF;
+// Set by advertising_start(), the button is ignored until Bluetooth is ready
+static bool advertising_started;
+static u32_t state_entered;
+
+// Running advertising set, if any
+static bool advertising_active;
+static bool advertising_connectable;
+
+// Directed advertising runs as a connection object of its own, held until it connects or times out
+static struct bt_conn *directed_conn;
+
+// Times each state was entered and milliseconds spent in it, to check the duty cycle
+static u32_t state_count[ADVERTISING_STATE_COUNT];
+static u32_t state_time[ADVERTISING_STATE_COUNT];
+
+// Time from the start of RECONNECT to the connection, in ms
+static bool reconnecting;
+static u32_t reconnect_started;
+static u32_t connected_at;
+static u32_t reconnect_count, reconnect_last, reconnect_min, reconnect_max;
+
+// Bonded peers, gathered when entering RECONNECT
+struct advertising_bonds {
+    u8_t count;
+    bt_addr_le_t first;
+};
+
+static void advertising_directed_release(void)
+{
+    if (directed_conn != NULL) {
+        bt_conn_unref(directed_conn);
+        directed_conn = NULL;
+    }
+}
+
+static int advertising_run(const struct bt_le_adv_param *param)
+{
+    int ret;
+
+    if (directed_conn != NULL) {
+        // Stops directed advertising, reported as a failed connection
+        bt_conn_disconnect(directed_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+        advertising_directed_release();
+    }
+
+    if (advertising_active) {
+        bt_le_adv_stop();
+        advertising_active = false;
+    }
+
+    if (param == NULL) {
+        return 0;
+    }
+
+    ret = bt_le_adv_start(param, advertising_data, ARRAY_SIZE(advertising_data), NULL, 0);
+    if (ret < 0) {
+        LOG_ERR("Advertising failed to start (%d)", ret);
+        return ret;
+    }
+
+    advertising_active = true;
+    advertising_connectable = (param->options & BT_LE_ADV_OPT_CONNECTABLE) != 0;
+
+    return 0;
+}
+
+// Keep broadcasting the readings where connectable advertising isn't wanted
+static int advertising_run_broadcast(void)
+{
+#if CONFIG_APP_BT_BROADCAST_NCONN
+    return advertising_run(ADVERTISING_NCONN_SLOW);
+#else
+    return advertising_run(NULL);
+#endif
+}
+
+static void bond_found(const struct bt_bond_info *info, void *user_data)
+{
+    *(bool *)user_data = true;
+}
+
+static bool advertising_bonded(void)
+{
+    bool bonded = false;
+
+    bt_foreach_bond(BT_ID_DEFAULT, bond_found, &bonded);
+
+    return bonded;
+}
+
+static void bond_whitelist(const struct bt_bond_info *info, void *user_data)
+{
+    struct advertising_bonds *bonds = user_data;
+    int err;
+
+    if (bonds->count++ == 0) {
+        bonds->first = info->addr;
+    }
+
+    err = bt_le_whitelist_add(&info->addr);
+    if (err) {
+        LOG_WRN("Failed to add a bond to the whitelist (Error %d)", err);
+    }
+}
+
+// Only let bonded peers connect, returns the number of bonds
+static u8_t advertising_reconnect(bool directed)
+{
+    struct advertising_bonds bonds = { 0 };
+
+    // The whitelist can't change while advertising uses it
+    advertising_run(NULL);
+    bt_le_whitelist_clear();
+    bt_foreach_bond(BT_ID_DEFAULT, bond_whitelist, &bonds);
+
+    if (bonds.count == 0) {
+        return 0;
+    }
+
+    if (directed && bonds.count == 1) {
+        // Times out by itself after 1.28 s, reported as a failed connection
+        directed_conn = bt_conn_create_slave_le(&bonds.first, BT_LE_ADV_CONN_DIR);
+        if (directed_conn != NULL) {
+            LOG_DBG("Directed advertising to the only bond");
+            return bonds.count;
+        }
+        LOG_WRN("Directed advertising failed to start");
+    }
+
+    if (advertising_run(ADVERTISING_CONN_BONDED) == 0) {
+        k_delayed_work_submit(&timeout_work, K_SECONDS(CONFIG_APP_BT_ADV_FAST_TIME));
+    }
+
+    return bonds.count;
+}
+
+static void advertising_reconnected(void)
+{
+    u32_t time = connected_at - reconnect_started;
+
+    reconnecting = false;
+
+    reconnect_last = time;
+    reconnect_min = (reconnect_count == 0 || time < reconnect_min) ? time : reconnect_min;
+    reconnect_max = MAX(time, reconnect_max);
+    reconnect_count++;
+
+    LOG_INF("Reconnected in %u ms", time);
+}
+
+static void advertising_enter(enum advertising_state next, const char *reason);
+
+// Step the slow state: stop when bonded for long enough, otherwise alternate the windows
+static void advertising_slow(bool enter)
+{
+    s32_t remaining = -1;
+    s32_t delay = -1;
+    bool connectable = true;
+
+    if (CONFIG_APP_BT_ADV_STOP_TIME > 0 && advertising_bonded()) {
+        remaining = (CONFIG_APP_BT_ADV_STOP_TIME * MSEC_PER_SEC) - (k_uptime_get_32() - state_entered);
+        if (remaining <= 0) {
+            advertising_enter(ADVERTISING_OFF, "timeout");
+            return;
+        }
+    }
+
+#if CONFIG_APP_BT_BROADCAST_NCONN
+    connectable = enter || !advertising_connectable;
+    delay = K_SECONDS(connectable ? CONFIG_APP_BT_CONN_WINDOW :
+                      CONFIG_APP_BT_CONN_PERIOD - CONFIG_APP_BT_CONN_WINDOW);
+#endif
+
+    if (enter || IS_ENABLED(CONFIG_APP_BT_BROADCAST_NCONN)) {
+        advertising_run(connectable ? ADVERTISING_CONN_SLOW : ADVERTISING_NCONN_SLOW);
+    }
+
+    if (remaining >= 0 && (delay < 0 || remaining < delay)) {
+        delay = remaining;
+    }
+    if (delay >= 0) {
+        k_delayed_work_submit(&timeout_work, delay);
+    }
+}
+
+static void advertising_enter(enum advertising_state next, const char *reason)
+{
+    u32_t now = k_uptime_get_32();
+
+    k_delayed_work_cancel(&timeout_work);
+
+    state_time[state] += now - state_entered;
+    state_count[next]++;
+
+    LOG_INF("%s -> %s (%s), entered reconnect %u fast %u slow %u off %u connected %u",
+            advertising_state_names[state], advertising_state_names[next], reason,
+            state_count[ADVERTISING_RECONNECT], state_count[ADVERTISING_FAST],
+            state_count[ADVERTISING_SLOW], state_count[ADVERTISING_OFF],
+            state_count[ADVERTISING_CONNECTED]);
+
+    state = next;
+    state_entered = now;
+
+    switch (state) {
+    case ADVERTISING_RECONNECT:
+        reconnecting = true;
+        reconnect_started = now;
+        if (advertising_reconnect(true) == 0) {
+            advertising_enter(ADVERTISING_FAST, "no bonds");
+        }
+        break;
+    case ADVERTISING_FAST:
+        if (advertising_run(ADVERTISING_CONN_FAST) == 0) {
+            k_delayed_work_submit(&timeout_work, K_SECONDS(CONFIG_APP_BT_ADV_FAST_TIME));
+        }
+        break;
+    case ADVERTISING_SLOW:
+        advertising_slow(true);
+        break;
+    case ADVERTISING_OFF:
+        advertising_run_broadcast();
+        break;
+    case ADVERTISING_CONNECTED:
+        advertising_run_broadcast();
+        break;
+    default:
+        break;
+    }
+}
+
+static void advertising_timeout_handler(struct k_work *work)
+{
+    if (state == ADVERTISING_RECONNECT || state == ADVERTISING_FAST) {
+        advertising_enter(ADVERTISING_SLOW, "timeout");
+    } else if (state == ADVERTISING_SLOW) {
+        advertising_slow(false);
+    }
+}
+
+static void advertising_update_data(void)
+{
+#if CONFIG_APP_BT_BROADCAST
+    k_mutex_lock(&broadcast_lock, K_FOREVER);
+
+    struct measurement measurement = broadcast_next;
+
+    k_mutex_unlock(&broadcast_lock);
+
+    if (sys_get_le16(&broadcast_data[BROADCAST_TEMPERATURE]) == (u16_t)measurement.temperature &&
+        sys_get_le16(&broadcast_data[BROADCAST_HUMIDITY]) == measurement.humidity &&
+        broadcast_data[BROADCAST_BATTERY] == measurement.battery) {
+        return;
+    }
+
+    sys_put_le16(measurement.temperature, &broadcast_data[BROADCAST_TEMPERATURE]);
+    sys_put_le16(measurement.humidity, &broadcast_data[BROADCAST_HUMIDITY]);
+    broadcast_data[BROADCAST_BATTERY] = measurement.battery;
+    broadcast_data[BROADCAST_COUNTER]++;
+
+    if (advertising_active) {
+        int ret = bt_le_adv_update_data(advertising_data, ARRAY_SIZE(advertising_data), NULL, 0);
+        if (ret < 0) {
+            LOG_WRN("Failed to update advertising data (%d)", ret);
+        }
+    }
+#endif
+}
+
+static void advertising_event_handler(struct k_work *work)
+{
+    atomic_val_t pending = atomic_clear(&events);
+
+    // Directed advertising has ended, with a connection or its timeout, and the stack is done with it
+    if (pending & (BIT(ADVERTISING_EVENT_CONNECTED) | BIT(ADVERTISING_EVENT_DIRECTED_DONE))) {
+        advertising_directed_release();
+    }
+
+    if (pending & BIT(ADVERTISING_EVENT_BOOT)) {
+        advertising_started = true;
+    }
+
+    if (pending & BIT(ADVERTISING_EVENT_CONNECTED)) {
+        // Connectable advertising was stopped by the stack when the central connected
+        if (advertising_connectable) {
+            advertising_active = false;
+        }
+
+        if (state == ADVERTISING_RECONNECT && reconnecting) {
+            advertising_reconnected();
+        }
+    }
+
+    // Connects and disconnects may both be pending and in either order, so the state follows the
+    // connection count rather than the order of the bits
+    if (pending & (BIT(ADVERTISING_EVENT_CONNECTED) | BIT(ADVERTISING_EVENT_DISCONNECTED) |
+                   BIT(ADVERTISING_EVENT_BOOT))) {
+        const char *reason = (pending & BIT(ADVERTISING_EVENT_BOOT)) ? "boot" :
+                             (pending & BIT(ADVERTISING_EVENT_DISCONNECTED)) ? "disconnected" : "connected";
+
+        if (atomic_get(&connection_count) >= CONFIG_BT_MAX_CONN) {
+            advertising_enter(ADVERTISING_CONNECTED, reason);
+        } else if (pending & (BIT(ADVERTISING_EVENT_DISCONNECTED) | BIT(ADVERTISING_EVENT_BOOT))) {
+            advertising_enter(advertising_bonded() ? ADVERTISING_RECONNECT : ADVERTISING_FAST, reason);
+        } else {
+            advertising_enter(ADVERTISING_SLOW, "connected, room for more");
+        }
+    }
+
+    if ((pending & BIT(ADVERTISING_EVENT_DIRECTED_DONE)) && state == ADVERTISING_RECONNECT) {
+        // Directed advertising timed out, carry on with the whitelist
+        advertising_reconnect(false);
+    }
+    if ((pending & BIT(ADVERTISING_EVENT_BUTTON)) && advertising_started &&
+        atomic_get(&connection_count) < CONFIG_BT_MAX_CONN) {
+        advertising_enter(ADVERTISING_FAST, "button");
+    }
+    if (pending & BIT(ADVERTISING_EVENT_DATA)) {
+        advertising_update_data();
+    }
+}
+
+static void advertising_event(int event)
+{
+    atomic_set_bit(&events, event);
+    k_work_submit(&event_work);
+}
+
+void advertising_start(void)
+{
+    advertising_event(ADVERTISING_EVENT_BOOT);
+}
+
+void advertising_wake(void)
+{
+    advertising_event(ADVERTISING_EVENT_BUTTON);
+}
+
+void advertising_connected(void)
+{
+    connected_at = k_uptime_get_32();
+    atomic_inc(&connection_count);
+    advertising_event(ADVERTISING_EVENT_CONNECTED);
+}
+
+void advertising_connection_failed(u8_t err)
+{
+    // Only directed advertising fails this way, on its timeout or otherwise. Stopping it ourselves
+    // is reported with the reason passed to bt_conn_disconnect().
+    if (err != BT_HCI_ERR_REMOTE_USER_TERM_CONN) {
+        advertising_event(ADVERTISING_EVENT_DIRECTED_DONE);
+    }
+}
+
+void advertising_disconnected(void)
+{
+    atomic_dec(&connection_count);
+    advertising_event(ADVERTISING_EVENT_DISCONNECTED);
+}
+
+void advertising_update_broadcast(const struct measurement *measurement)
+{
+    k_mutex_lock(&broadcast_lock, K_FOREVER);
+    broadcast_next = *measurement;
+    k_mutex_unlock(&broadcast_lock);
+
+    advertising_event(ADVERTISING_EVENT_DATA);
+}
+
+static int cmd_advertising(const struct shell *shell, size_t argc, char **argv)
+{
+    u32_t now = k_uptime_get_32();
+
+    shell_print(shell, "Advertising %s for %u s", advertising_state_names[state],
+                (now - state_entered) / MSEC_PER_SEC);
+
+    for (int i = 0; i < ADVERTISING_STATE_COUNT; i++) {
+        u32_t time = state_time[i] + ((i == state) ? (now - state_entered) : 0);
+
+        shell_print(shell, "%-9s entered %u times, %u s", advertising_state_names[i], state_count[i],
+                    time / MSEC_PER_SEC);
+    }
+
+    if (reconnect_count > 0) {
+        shell_print(shell, "%u reconnections, last %u ms, min %u ms, max %u ms", reconnect_count,
+                    reconnect_last, reconnect_min, reconnect_max);
+    }
+
+    return 0;
+}
+
+SHELL_CMD_REGISTER(advertising, NULL, "Advertising state and time spent in each state", cmd_advertising);
+
+static int advertising_init(struct device *dev)
+{
+    ARG_UNUSED(dev);
+
+    k_work_init(&event_work, advertising_event_handler);
+    k_delayed_work_init(&timeout_work, advertising_timeout_handler);
+
+    return 0;
+}
+
+SYS_INIT(advertising_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
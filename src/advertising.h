@@ -0,0 +1,33 @@
+#pragma once
+
+#include <zephyr/types.h>
+
+#include "measurement.h"
+
+/**
+ * Advertising policy: advertise with a fast interval for
+ * CONFIG_APP_BT_ADV_FAST_TIME seconds after boot, a button press or a
+ * disconnect, then with a slow one. After boot and disconnects only bonded
+ * peers are let in during the fast window. Once bonded peers exist advertising
+ * stops after CONFIG_APP_BT_ADV_STOP_TIME seconds, until the next event.
+ *
+ * The functions below only queue an event for the system work queue, the
+ * state changes themselves run there. All but
+ * advertising_update_broadcast() can be called from interrupts.
+ */
+
+/** Start advertising once Bluetooth is ready. */
+void advertising_start(void);
+
+/** Advertise fast again, e.g. after a button press. */
+void advertising_wake(void);
+
+void advertising_connected(void);
+void advertising_connection_failed(u8_t err);
+void advertising_disconnected(void);
+
+/**
+ * Put the readings in the advertising data, the advertising data is only
+ * updated when they change.
+ */
+void advertising_update_broadcast(const struct measurement *measurement);
@@ -16,6 +16,10 @@
 #include <logging/log.h>
 LOG_MODULE_REGISTER(bluetooth, LOG_LEVEL_INF);
 
+#include "bluetooth.h"
+#include "advertising.h"
+#include "mesh.h"
+
 /* ESS error definitions */
 #define ESS_ERR_WRITE_REJECT    0x80
 #define ESS_ERR_COND_NOT_SUPP   0x81
@@ -39,21 +43,24 @@ struct bt_conn *default_conn;
 
 static bool allow_bonding = false;
 
-static const struct bt_data bluettoth_advertise_data[] = {
-	BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
-	BT_DATA_BYTES(BT_DATA_UUID16_ALL,
-		      0x1a, 0x18, /* Environmental Sensing Service */
-		      0x0a, 0x18, /* Device Information Service */
-		      0x0f, 0x18), /* Battery Service */
-};
+// When each connection came up and when pairing started, to time pairing and encryption
+static s64_t connected_at[CONFIG_BT_MAX_CONN];
+static s64_t pairing_started;
 
 static void bluetooth_connected(struct bt_conn *conn, u8_t err)
 {
 	if (err) {
 		LOG_WRN("Connection failed (err 0x%02x)", err);
+		advertising_connection_failed(err);
+		return;
 	} else {
-		default_conn = bt_conn_ref(conn);
+		// The shell works on the first connection
+		if (default_conn == NULL) {
+			default_conn = bt_conn_ref(conn);
+		}
 		LOG_INF("Bluetooth connected");
+		connected_at[bt_conn_index(conn)] = k_uptime_get();
+		advertising_connected();
 	}
 
     if (bt_conn_set_security(conn, BT_SECURITY_L3)) {
@@ -65,20 +72,34 @@ static void bluetooth_disconnected(struct bt_conn *conn, u8_t reason)
 {
 	LOG_INF("Disconnected (reason 0x%02x)", reason);
 
-	if (default_conn) {
+	if (default_conn == conn) {
 		bt_conn_unref(default_conn);
 		default_conn = NULL;
 	}
+
+	advertising_disconnected();
+}
+
+static void bluetooth_security_changed(struct bt_conn *conn, bt_security_t level, enum bt_security_err err)
+{
+	if (err) {
+		return;
+	}
+
+	LOG_INF("Security level %d, %u ms after connecting", level,
+		(u32_t)(k_uptime_get() - connected_at[bt_conn_index(conn)]));
 }
 
 static struct bt_conn_cb bluetooth_connection_callbacks = {
 	.connected = bluetooth_connected,
 	.disconnected = bluetooth_disconnected,
+	.security_changed = bluetooth_security_changed,
 };
 
 static void auth_confirm(struct bt_conn *conn)
 {
     if(allow_bonding){
+        pairing_started = k_uptime_get();
         bt_conn_auth_pairing_confirm(conn);
     } else {
         bt_conn_auth_cancel(conn);
@@ -95,6 +116,12 @@ static void auth_cancel(struct bt_conn *conn)
 	LOG_WRN("Pairing cancelled: %s", addr);
 }
 
+static void pairing_complete(struct bt_conn *conn, bool bonded)
+{
+	// Dominated by the DHKey computation on the nRF51
+	LOG_INF("Pairing took %u ms%s", (u32_t)(k_uptime_get() - pairing_started), bonded ? ", bonded" : "");
+}
+
 static void pairing_failed(struct bt_conn *conn, enum bt_security_err reason)
 {
 	LOG_WRN("Pairing Failed (%d)", reason);
@@ -103,6 +130,7 @@ static void pairing_failed(struct bt_conn *conn, enum bt_security_err reason)
 static struct bt_conn_auth_cb bluetooth_auth_cb_display = {
 	.cancel = auth_cancel,
     .pairing_confirm = auth_confirm,
+    .pairing_complete = pairing_complete,
     .pairing_failed = pairing_failed,
     .passkey_display = NULL,
     .passkey_entry = NULL,
@@ -111,19 +139,16 @@ static struct bt_conn_auth_cb bluetooth_auth_cb_display = {
 
 void bluetooth_ready()
 {
-	int ret;
-
-	ret = bt_le_adv_start(BT_LE_ADV_CONN_NAME, bluettoth_advertise_data, ARRAY_SIZE(bluettoth_advertise_data), NULL, 0);
-	if (ret < 0) {
-		LOG_ERR("Advertising failed to start (%d)", ret);
-		return;
-	}
-
-	LOG_DBG("Advertising successfully started");
-
     bt_conn_cb_register(&bluetooth_connection_callbacks);
 	bt_conn_auth_cb_register(&bluetooth_auth_cb_display);
 
+#if CONFIG_APP_MESH
+	// The mesh owns the advertiser
+	mesh_start();
+#else
+	advertising_start();
+#endif
+
 	LOG_DBG("Initialized");
 }
 
@@ -141,3 +166,4 @@ void bluetooth_set_bonding(bool allow) {
 bool bluetooth_get_bonding() {
     return allow_bonding;
 }
+
@@ -1,10 +1,18 @@
 #pragma once
 
+#include "measurement.h"
+
 void bluetooth_ready(void);
 void bluetooth_set_bonding(bool allow);
 bool bluetooth_get_bonding();
 
 void bluetooth_update_battery(u8_t level);
 
-void bluetooth_update_temperature(u16_t value);
+void bluetooth_update_temperature(s16_t value);
 void bluetooth_update_humidity(u16_t value);
+
+// Report how often the ESS characteristics are updated (in seconds)
+void bluetooth_set_update_interval(u32_t seconds);
+
+// Queue a sample for the snapshot characteristic, subscribers get it in batches of their choice
+void bluetooth_update_snapshot(const struct measurement *measurement);
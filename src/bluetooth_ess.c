@@ -5,6 +5,7 @@
 #include <sys/printk.h>
 #include <sys/byteorder.h>
 #include <zephyr.h>
+#include <init.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
@@ -12,10 +13,13 @@
 #include <bluetooth/uuid.h>
 #include <bluetooth/gatt.h>
 #include <bluetooth/services/bas.h>
+#include <settings/settings.h>
 
 #include <logging/log.h>
 LOG_MODULE_REGISTER(bluetooth_ess_service, LOG_LEVEL_INF);
 
+#include "notify_queue.h"
+
 // ESS error definitions
 #define ESS_ERR_WRITE_REJECT    0x80
 #define ESS_ERR_COND_NOT_SUPP   0x81
@@ -34,8 +38,6 @@ LOG_MODULE_REGISTER(bluetooth_ess_service, LOG_LEVEL_INF);
 
 #define ESS_MEASUREMENT_FLAG_NOTIFY_MEASUREMENT BIT(1)
 
-extern struct bt_conn *default_conn;
-
 struct es_measurement {
     // Reserved for Future Use
     u16_t flags;
@@ -46,37 +48,73 @@ struct es_measurement {
     u8_t meas_uncertainty;
 };
 
-struct ess_sensor {
-    s16_t value;
+// ES Trigger Setting descriptors per characteristic, combined as set in the ES Configuration descriptor
+#define ESS_TRIGGER_COUNT 2
 
-    // Valid Range
-    s16_t lower_limit;
-    s16_t upper_limit;
+// ES Configuration - Trigger Logic
+#define ESS_TRIGGER_LOGIC_AND   0x00
+#define ESS_TRIGGER_LOGIC_OR    0x01
 
+struct ess_trigger {
     // ES trigger setting - Value Notification condition
     u8_t condition;
-    u16_t ccc;
     union {
         u32_t seconds;
         // Reference temperature
         s16_t ref_val;
     };
+};
+
+// What gets persisted for each sensor
+struct ess_trigger_config {
+    u8_t logic;
+    struct ess_trigger triggers[ESS_TRIGGER_COUNT];
+};
+
+// What a connection was last sent, the time based conditions run per connection
+struct ess_peer {
+    // When the last notification was sent (uptime in ms), and the value it carried
+    s64_t last_notify;
+    s16_t notified_value;
+};
+
+struct ess_sensor {
+    s16_t value;
+
+    // Valid Range
+    s16_t lower_limit;
+    s16_t upper_limit;
+
+    u16_t ccc;
+    struct ess_trigger_config config;
 
     struct es_measurement meas;
+
+    // Settings key the trigger configuration is stored under
+    const char *settings_name;
+    // Characteristic value attribute, for notifications sent outside of a value update
+    const struct bt_gatt_attr *attr;
+    // Indexed by bt_conn_index()
+    struct ess_peer peers[CONFIG_BT_MAX_CONN];
+    // Sends notifications that are due because of time rather than a new value
+    struct k_delayed_work notify_work;
 };
 
 #define SENSOR_TEMPERATURE_NAME "Temperature"
 
 static struct ess_sensor sensor_temp = {
     .value = 1200,
-    .lower_limit = 0,
+    // The sensor measures down to -40 degC
+    .lower_limit = -4000,
     .upper_limit = 6500,
-    .condition = ESS_VALUE_CHANGED,
+    .config.logic = ESS_TRIGGER_LOGIC_OR,
+    .config.triggers[0].condition = ESS_VALUE_CHANGED,
     .meas.sampling_func = 0x01,
     .meas.meas_period = 0x00,
     .meas.update_interval = 1,
     .meas.application = 0x01,
     .meas.meas_uncertainty = 0x01,
+    .settings_name = "temp",
 };
 
 #define SENSOR_Humidity_NAME "Humidity"
@@ -85,14 +123,17 @@ static struct ess_sensor sensor_humid = {
     .value = 5000,
     .lower_limit = 0,
     .upper_limit = 10000,
-    .condition = ESS_VALUE_CHANGED,
+    .config.logic = ESS_TRIGGER_LOGIC_OR,
+    .config.triggers[0].condition = ESS_VALUE_CHANGED,
     .meas.sampling_func = 0x01,
     .meas.meas_period = 0x00,
     .meas.update_interval = 1,
     .meas.application = 0x01,
     .meas.meas_uncertainty = 0x01,
+    .settings_name = "humid",
 };
 
+static struct ess_sensor *const ess_sensors[] = { &sensor_temp, &sensor_humid };
 
 static ssize_t read_u16(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf, u16_t len, u16_t offset)
 {
@@ -102,13 +143,17 @@ static ssize_t read_u16(struct bt_conn *conn, const struct bt_gatt_attr *attr, v
 	return bt_gatt_attr_read(conn, attr, buf, len, offset, &value, sizeof(value));
 }
 
+static void ess_schedule(struct ess_sensor *sensor);
+
 static void humid_ccc_cfg_changed(const struct bt_gatt_attr *attr, u16_t value)
 {
     sensor_humid.ccc = value;
+    ess_schedule(&sensor_humid);
 }
 static void temp_ccc_cfg_changed(const struct bt_gatt_attr *attr, u16_t value)
 {
     sensor_temp.ccc = value;
+    ess_schedule(&sensor_temp);
 }
 
 struct read_es_measurement_rp {
@@ -157,45 +202,186 @@ struct es_trigger_setting_reference {
     s16_t ref_val;
 } __packed;
 
+// Sensor a trigger belongs to
+static struct ess_sensor *ess_sensor_of(const struct ess_trigger *trigger)
+{
+    for (int i = 0; i < ARRAY_SIZE(ess_sensors); i++) {
+        const struct ess_trigger *triggers = ess_sensors[i]->config.triggers;
+
+        if (trigger >= triggers && trigger < &triggers[ESS_TRIGGER_COUNT]) {
+            return ess_sensors[i];
+        }
+    }
+
+    return NULL;
+}
+
+static bool ess_time_condition(u8_t condition)
+{
+    return condition == ESS_FIXED_TIME_INTERVAL || condition == ESS_NO_LESS_THAN_SPECIFIED_TIME;
+}
+
 static ssize_t read_ess_trigger_setting(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf, u16_t len, u16_t offset)
 {
-    const struct ess_sensor *sensor = attr->user_data;
+    const struct ess_trigger *trigger = attr->user_data;
     struct es_trigger_setting_reference settings_reference;
     struct es_trigger_setting_seconds settings_seconds;
 
-    switch (sensor->condition) {
+    switch (trigger->condition) {
         // Operand N/A
         case ESS_TRIGGER_INACTIVE: // fallthrough
         case ESS_VALUE_CHANGED:
-            return bt_gatt_attr_read(conn, attr, buf, len, offset, &sensor->condition, sizeof(sensor->condition));
+            return bt_gatt_attr_read(conn, attr, buf, len, offset, &trigger->condition, sizeof(trigger->condition));
         // Seconds
         case ESS_FIXED_TIME_INTERVAL: // fallthrough
         case ESS_NO_LESS_THAN_SPECIFIED_TIME:
 
-            settings_seconds.condition = sensor->condition;
-            sys_put_le24(sensor->seconds, settings_seconds.sec);
+            settings_seconds.condition = trigger->condition;
+            sys_put_le24(trigger->seconds, settings_seconds.sec);
 
             return bt_gatt_attr_read(conn, attr, buf, len, offset, &settings_seconds, sizeof(settings_seconds));
 
         // Reference temperature
         default:
 
-            settings_reference.condition = sensor->condition;
-            settings_reference.ref_val = sys_cpu_to_le16(sensor->ref_val);
+            settings_reference.condition = trigger->condition;
+            settings_reference.ref_val = sys_cpu_to_le16(trigger->ref_val);
 
             return bt_gatt_attr_read(conn, attr, buf, len, offset, &settings_reference, sizeof(settings_reference));
     }
 }
 
-static bool check_condition(u8_t condition, s16_t old_val, s16_t new_val, s16_t ref_val)
+static void ess_save(struct ess_sensor *sensor)
+{
+#if CONFIG_SETTINGS
+    char name[16];
+    int err;
+
+    snprintk(name, sizeof(name), "ess/%s", sensor->settings_name);
+
+    err = settings_save_one(name, &sensor->config, sizeof(sensor->config));
+    if (err) {
+        LOG_ERR("Failed to save %s triggers (Error %d)", sensor->settings_name, err);
+    }
+#endif
+}
+
+static ssize_t write_ess_trigger_setting(struct bt_conn *conn, const struct bt_gatt_attr *attr, const void *buf, u16_t len, u16_t offset, u8_t flags)
+{
+    struct ess_trigger *trigger = attr->user_data;
+    struct ess_sensor *sensor = ess_sensor_of(trigger);
+    const u8_t *data = buf;
+    struct ess_trigger update = { 0 };
+
+    if (offset != 0) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+
+    if (len < 1) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    update.condition = data[0];
+
+    switch (update.condition) {
+        // Operand N/A
+        case ESS_TRIGGER_INACTIVE: // fallthrough
+        case ESS_VALUE_CHANGED:
+            if (len != 1) {
+                return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+            }
+            break;
+        // Seconds
+        case ESS_FIXED_TIME_INTERVAL: // fallthrough
+        case ESS_NO_LESS_THAN_SPECIFIED_TIME:
+            if (len != sizeof(struct es_trigger_setting_seconds)) {
+                return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+            }
+
+            update.seconds = sys_get_le24(&data[1]);
+            if (update.seconds == 0) {
+                return BT_GATT_ERR(ESS_ERR_WRITE_REJECT);
+            }
+            break;
+        // Reference value
+        case ESS_LESS_THAN_REF_VALUE ... ESS_NOT_EQUAL_TO_REF_VALUE:
+            if (len != sizeof(struct es_trigger_setting_reference)) {
+                return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+            }
+
+            update.ref_val = (s16_t)sys_get_le16(&data[1]);
+            if (update.ref_val < sensor->lower_limit || update.ref_val > sensor->upper_limit) {
+                return BT_GATT_ERR(ESS_ERR_WRITE_REJECT);
+            }
+            break;
+        default:
+            return BT_GATT_ERR(ESS_ERR_COND_NOT_SUPP);
+    }
+
+    *trigger = update;
+
+    LOG_INF("%s trigger %d set to condition %02X", sensor->settings_name,
+            trigger - sensor->config.triggers, trigger->condition);
+
+    ess_save(sensor);
+    ess_schedule(sensor);
+
+    return len;
+}
+
+static ssize_t read_ess_configuration(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf, u16_t len, u16_t offset)
+{
+    const struct ess_sensor *sensor = attr->user_data;
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &sensor->config.logic, sizeof(sensor->config.logic));
+}
+
+static ssize_t write_ess_configuration(struct bt_conn *conn, const struct bt_gatt_attr *attr, const void *buf, u16_t len, u16_t offset, u8_t flags)
+{
+    struct ess_sensor *sensor = attr->user_data;
+
+    if (offset != 0) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+
+    if (len != sizeof(sensor->config.logic)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    u8_t logic = *(const u8_t *)buf;
+
+    if (logic != ESS_TRIGGER_LOGIC_AND && logic != ESS_TRIGGER_LOGIC_OR) {
+        return BT_GATT_ERR(ESS_ERR_WRITE_REJECT);
+    }
+
+    sensor->config.logic = logic;
+
+    ess_save(sensor);
+    ess_schedule(sensor);
+
+    return len;
+}
+
+// Milliseconds until the trigger's time requirement is met for a connection, 0 if it already is
+static s32_t ess_time_remaining(const struct ess_peer *peer, const struct ess_trigger *trigger)
+{
+    s64_t due = peer->last_notify + ((s64_t)trigger->seconds * MSEC_PER_SEC);
+    s64_t remaining = due - k_uptime_get();
+
+    return (remaining > 0) ? (s32_t)remaining : 0;
+}
+
+static bool check_condition(const struct ess_peer *peer, const struct ess_trigger *trigger, s16_t old_val, s16_t new_val)
 {
-    switch (condition) {
+    s16_t ref_val = trigger->ref_val;
+
+    switch (trigger->condition) {
         case ESS_TRIGGER_INACTIVE:
             return false;
         case ESS_FIXED_TIME_INTERVAL:
+            return ess_time_remaining(peer, trigger) == 0;
         case ESS_NO_LESS_THAN_SPECIFIED_TIME:
-            // TODO: Check time requirements
-            return false;
+            return new_val != peer->notified_value && ess_time_remaining(peer, trigger) == 0;
         case ESS_VALUE_CHANGED:
             return new_val != old_val;
         case ESS_LESS_THAN_REF_VALUE:
@@ -215,7 +401,147 @@ static bool check_condition(u8_t condition, s16_t old_val, s16_t new_val, s16_t
     }
 }
 
-static void update_ess_value(struct bt_conn *conn, const struct bt_gatt_attr *chrc, s16_t value, struct ess_sensor *sensor)
+// Combine the active triggers as set in the ES Configuration descriptor
+static bool check_triggers(const struct ess_sensor *sensor, const struct ess_peer *peer, s16_t old_val, s16_t new_val)
+{
+    bool any_active = false;
+
+    for (int i = 0; i < ESS_TRIGGER_COUNT; i++) {
+        const struct ess_trigger *trigger = &sensor->config.triggers[i];
+
+        if (trigger->condition == ESS_TRIGGER_INACTIVE) {
+            continue;
+        }
+
+        any_active = true;
+        bool met = check_condition(peer, trigger, old_val, new_val);
+
+        if (sensor->config.logic == ESS_TRIGGER_LOGIC_OR && met) {
+            return true;
+        }
+        if (sensor->config.logic == ESS_TRIGGER_LOGIC_AND && !met) {
+            return false;
+        }
+    }
+
+    return any_active && sensor->config.logic == ESS_TRIGGER_LOGIC_AND;
+}
+
+struct ess_notify_ctx {
+    struct ess_sensor *sensor;
+    s16_t old_val;
+    // The value as sent, encoded once for all connections
+    s16_t encoded;
+    s64_t now;
+    u8_t sent;
+};
+
+static void ess_notify_conn(struct bt_conn *conn, void *data)
+{
+    struct ess_notify_ctx *ctx = data;
+    struct ess_sensor *sensor = ctx->sensor;
+    struct ess_peer *peer = &sensor->peers[bt_conn_index(conn)];
+
+    if (!bt_gatt_is_subscribed(conn, sensor->attr, BT_GATT_CCC_NOTIFY)) {
+        return;
+    }
+
+    if (!check_triggers(sensor, peer, ctx->old_val, sensor->value)) {
+        return;
+    }
+
+    if (notify_queue_push(conn, sensor->attr, &ctx->encoded, sizeof(ctx->encoded)) == 0) {
+        peer->last_notify = ctx->now;
+        peer->notified_value = sensor->value;
+        ctx->sent++;
+    }
+}
+
+// Notify every subscribed connection whose triggers are met
+static u8_t ess_notify(struct ess_sensor *sensor, s16_t old_val)
+{
+    struct ess_notify_ctx ctx = {
+        .sensor = sensor,
+        .old_val = old_val,
+        .encoded = sys_cpu_to_le16(sensor->value),
+        .now = k_uptime_get(),
+    };
+
+    if (sensor->ccc != BT_GATT_CCC_NOTIFY) {
+        return 0;
+    }
+
+    bt_conn_foreach(BT_CONN_TYPE_LE, ess_notify_conn, &ctx);
+
+    return ctx.sent;
+}
+
+struct ess_schedule_ctx {
+    struct ess_sensor *sensor;
+    s32_t delay;
+};
+
+static void ess_schedule_conn(struct bt_conn *conn, void *data)
+{
+    struct ess_schedule_ctx *ctx = data;
+    struct ess_sensor *sensor = ctx->sensor;
+    const struct ess_peer *peer = &sensor->peers[bt_conn_index(conn)];
+
+    if (!bt_gatt_is_subscribed(conn, sensor->attr, BT_GATT_CCC_NOTIFY)) {
+        return;
+    }
+
+    for (int i = 0; i < ESS_TRIGGER_COUNT; i++) {
+        const struct ess_trigger *trigger = &sensor->config.triggers[i];
+
+        if (!ess_time_condition(trigger->condition)) {
+            continue;
+        }
+
+        // A held back change waits for the interval, no change means nothing to send
+        if (trigger->condition == ESS_NO_LESS_THAN_SPECIFIED_TIME && sensor->value == peer->notified_value) {
+            continue;
+        }
+
+        s32_t remaining = ess_time_remaining(peer, trigger);
+        if (remaining > 0 && (ctx->delay == 0 || remaining < ctx->delay)) {
+            ctx->delay = remaining;
+        }
+    }
+}
+
+// (Re)start the timer behind the time based conditions, after a notification or when the
+// triggers or CCC change. It fires when the next time requirement of any subscribed connection
+// will be met, and only if that could lead to a notification without a new value.
+static void ess_schedule(struct ess_sensor *sensor)
+{
+    struct ess_schedule_ctx ctx = {
+        .sensor = sensor,
+        .delay = 0,
+    };
+
+    if (sensor->ccc == BT_GATT_CCC_NOTIFY) {
+        bt_conn_foreach(BT_CONN_TYPE_LE, ess_schedule_conn, &ctx);
+    }
+
+    if (ctx.delay > 0) {
+        k_delayed_work_submit(&sensor->notify_work, ctx.delay);
+    } else {
+        k_delayed_work_cancel(&sensor->notify_work);
+    }
+}
+
+static void ess_notify_work_handler(struct k_work *work)
+{
+    struct ess_sensor *sensor = CONTAINER_OF(work, struct ess_sensor, notify_work);
+
+    // No new value, so "value changed" can't be what's being waited for here
+    ess_notify(sensor, sensor->value);
+
+    ess_schedule(sensor);
+}
+
+static void update_ess_value(s16_t value, struct ess_sensor *sensor)
 {
     if(sensor == &sensor_temp){
         LOG_DBG("Updating temperature");
@@ -225,22 +551,28 @@ static void update_ess_value(struct bt_conn *conn, const struct bt_gatt_attr *ch
         LOG_DBG("I don't know what i'm updateing 🤷‍♀️");
     }
 
-    bool notify = check_condition(sensor->condition, sensor->value, value, sensor->ref_val);
-    LOG_DBG("Condition: %02X, Ref: %d, Old Value: %d, New Value: %d => %s", sensor->condition, sensor->ref_val, sensor->value, value, notify ? "true" : "false");
+    s16_t old_val = sensor->value;
 
     // Update temperature value
     sensor->value = value;
 
-    // Trigger notification if conditions are met
-    if (notify){
-        if (sensor->ccc == BT_GATT_CCC_NOTIFY) {
-            value = sys_cpu_to_le16(sensor->value);
+    // Trigger notification where the conditions are met
+    u8_t sent = ess_notify(sensor, old_val);
+    LOG_DBG("Logic: %02X, Old Value: %d, New Value: %d => %u queued", sensor->config.logic, old_val, value, sent);
 
-            bt_gatt_notify(conn, chrc, &value, sizeof(value));
-        }
-    }
+    ess_schedule(sensor);
 }
 
+#define ESS_TRIGGER_SETTING_DESCRIPTOR(_trigger) \
+    BT_GATT_DESCRIPTOR(BT_UUID_ES_TRIGGER_SETTING, \
+               BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT, \
+               read_ess_trigger_setting, write_ess_trigger_setting, _trigger)
+
+#define ESS_CONFIGURATION_DESCRIPTOR(_sensor) \
+    BT_GATT_DESCRIPTOR(BT_UUID_ES_CONFIGURATION, \
+               BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT, \
+               read_ess_configuration, write_ess_configuration, _sensor)
+
 BT_GATT_SERVICE_DEFINE(ess,
     BT_GATT_PRIMARY_SERVICE(BT_UUID_ESS),
 
@@ -254,9 +586,9 @@ BT_GATT_SERVICE_DEFINE(ess,
     BT_GATT_CUD(SENSOR_TEMPERATURE_NAME, BT_GATT_PERM_READ_ENCRYPT),
     BT_GATT_DESCRIPTOR(BT_UUID_VALID_RANGE, BT_GATT_PERM_READ_ENCRYPT,
                read_ess_valid_range, NULL, &sensor_temp),
-    BT_GATT_DESCRIPTOR(BT_UUID_ES_TRIGGER_SETTING,
-               BT_GATT_PERM_READ_ENCRYPT, read_ess_trigger_setting,
-               NULL, &sensor_temp),
+    ESS_TRIGGER_SETTING_DESCRIPTOR(&sensor_temp.config.triggers[0]),
+    ESS_TRIGGER_SETTING_DESCRIPTOR(&sensor_temp.config.triggers[1]),
+    ESS_CONFIGURATION_DESCRIPTOR(&sensor_temp),
     BT_GATT_CCC(temp_ccc_cfg_changed,
             BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
 
@@ -270,19 +602,107 @@ BT_GATT_SERVICE_DEFINE(ess,
 	BT_GATT_CUD(SENSOR_Humidity_NAME, BT_GATT_PERM_READ_ENCRYPT),
 	BT_GATT_DESCRIPTOR(BT_UUID_VALID_RANGE, BT_GATT_PERM_READ_ENCRYPT,
 			   read_ess_valid_range, NULL, &sensor_humid),
-	BT_GATT_DESCRIPTOR(BT_UUID_ES_TRIGGER_SETTING,
-			   BT_GATT_PERM_READ_ENCRYPT, read_ess_trigger_setting,
-			   NULL, &sensor_humid),
+	ESS_TRIGGER_SETTING_DESCRIPTOR(&sensor_humid.config.triggers[0]),
+	ESS_TRIGGER_SETTING_DESCRIPTOR(&sensor_humid.config.triggers[1]),
+	ESS_CONFIGURATION_DESCRIPTOR(&sensor_humid),
 	BT_GATT_CCC(humid_ccc_cfg_changed,
 		    BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
 );
 
-void bluetooth_update_temperature(u16_t value)
+void bluetooth_update_temperature(s16_t value)
 {
-    update_ess_value(default_conn, &ess.attrs[2], value, &sensor_temp);
+    update_ess_value(value, &sensor_temp);
 }
 
 void bluetooth_update_humidity(u16_t value)
 {
-    update_ess_value(default_conn, &ess.attrs[8], value, &sensor_humid);
+    update_ess_value(value, &sensor_humid);
+}
+
+void bluetooth_set_update_interval(u32_t seconds)
+{
+    sensor_temp.meas.update_interval = seconds;
+    sensor_humid.meas.update_interval = seconds;
+}
+
+#if CONFIG_SETTINGS
+
+static int ess_settings_set(const char *name, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+    for (int i = 0; i < ARRAY_SIZE(ess_sensors); i++) {
+        struct ess_sensor *sensor = ess_sensors[i];
+        struct ess_trigger_config config;
+        const char *next;
+
+        if (!settings_name_steq(name, sensor->settings_name, &next) || next) {
+            continue;
+        }
+
+        if (len != sizeof(config)) {
+            LOG_WRN("Ignoring stored %s triggers of the wrong size", sensor->settings_name);
+            return -EINVAL;
+        }
+
+        ssize_t ret = read_cb(cb_arg, &config, sizeof(config));
+        if (ret < 0) {
+            return ret;
+        }
+
+        sensor->config = config;
+        ess_schedule(sensor);
+
+        LOG_DBG("Loaded %s triggers", sensor->settings_name);
+        return 0;
+    }
+
+    return -ENOENT;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(ess, "ess", NULL, ess_settings_set, NULL, NULL);
+
+#endif // CONFIG_SETTINGS
+
+static void ess_connected(struct bt_conn *conn, u8_t err)
+{
+    if (err) {
+        return;
+    }
+
+    // A new connection starts without any history, so fixed intervals are due right away
+    for (int i = 0; i < ARRAY_SIZE(ess_sensors); i++) {
+        struct ess_peer *peer = &ess_sensors[i]->peers[bt_conn_index(conn)];
+
+        peer->last_notify = 0;
+        peer->notified_value = ess_sensors[i]->value;
+    }
+}
+
+static void ess_disconnected(struct bt_conn *conn, u8_t reason)
+{
+    // The remaining connections may have later deadlines
+    for (int i = 0; i < ARRAY_SIZE(ess_sensors); i++) {
+        ess_schedule(ess_sensors[i]);
+    }
+}
+
+static struct bt_conn_cb ess_connection_callbacks = {
+    .connected = ess_connected,
+    .disconnected = ess_disconnected,
+};
+
+static int bluetooth_ess_init(struct device *dev)
+{
+    ARG_UNUSED(dev);
+
+    sensor_temp.attr = &ess.attrs[2];
+    sensor_humid.attr = &ess.attrs[11];
+
+    k_delayed_work_init(&sensor_temp.notify_work, ess_notify_work_handler);
+    k_delayed_work_init(&sensor_humid.notify_work, ess_notify_work_handler);
+
+    bt_conn_cb_register(&ess_connection_callbacks);
+
+    return 0;
 }
+
+SYS_INIT(bluetooth_ess_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,449 @@
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/byteorder.h>
+#include <zephyr.h>
+#include <init.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/uuid.h>
+#include <bluetooth/gatt.h>
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(bluetooth_history_service, LOG_LEVEL_INF);
+
+#include "flash_log.h"
+#include "connection.h"
+
+// Bulk download of the flash log.
+//
+// A client subscribes to the Records and Control Point characteristics and writes a request to
+// the Control Point. Records are then streamed as notifications, each packing as many log records
+// as fit in the ATT MTU behind the index of the first one:
+//
+//   u32 index | struct flash_log_record | struct flash_log_record | ...
+//
+// all little endian. The index following the last record received is where to resume from.
+//
+// Once done (or aborted) the Control Point notifies a response carrying the resume token, the
+// index of the next record to send. Writing it back with HISTORY_OP_RESUME continues an
+// interrupted transfer with the same end condition, across reconnections.
+
+// Control Point requests
+#define HISTORY_OP_REQUEST_INDEX    0x01    // u32 first index, u32 count (0 for all)
+#define HISTORY_OP_REQUEST_TIME     0x02    // u16 boot, u32 from, u16 boot, u32 to (seconds)
+#define HISTORY_OP_RESUME           0x03    // u32 resume token
+#define HISTORY_OP_ABORT            0x04
+
+// Control Point response: 0x80 | opcode, u8 status, u32 resume token, u32 records sent,
+// u32 duration (ms), u16 connection events per KB
+#define HISTORY_OP_RESPONSE         0x80
+
+#define HISTORY_STATUS_SUCCESS          0x00
+#define HISTORY_STATUS_ABORTED          0x01
+#define HISTORY_STATUS_FAILED           0x02
+
+// ATT notification header size, and our own header
+#define HISTORY_ATT_OVERHEAD    3
+#define HISTORY_HEADER_SIZE     sizeof(u32_t)
+
+#define HISTORY_PACKET_MAX (HISTORY_HEADER_SIZE + (CONFIG_APP_HISTORY_TX_RECORDS * sizeof(struct flash_log_record)))
+
+static struct bt_uuid_128 history_service_uuid = BT_UUID_INIT_128(
+    0x5a, 0x1d, 0x2c, 0x5b, 0x6e, 0x3f, 0x4a, 0x8e,
+    0x9d, 0x41, 0x7b, 0x10, 0x00, 0x00, 0x4d, 0x54);
+
+static struct bt_uuid_128 history_records_uuid = BT_UUID_INIT_128(
+    0x5a, 0x1d, 0x2c, 0x5b, 0x6e, 0x3f, 0x4a, 0x8e,
+    0x9d, 0x41, 0x7b, 0x10, 0x01, 0x00, 0x4d, 0x54);
+
+static struct bt_uuid_128 history_control_uuid = BT_UUID_INIT_128(
+    0x5a, 0x1d, 0x2c, 0x5b, 0x6e, 0x3f, 0x4a, 0x8e,
+    0x9d, 0x41, 0x7b, 0x10, 0x02, 0x00, 0x4d, 0x54);
+
+struct history_transfer {
+    // Referenced while the transfer is active
+    struct bt_conn *conn;
+    u8_t opcode;
+    bool active;
+
+    struct flash_log_iter iter;
+    // Index to stop at, and the time window for time range requests
+    u32_t end;
+    bool by_time;
+    u64_t time_from;
+    u64_t time_to;
+
+    // Record read ahead that didn't fit in the last packet
+    struct flash_log_record next;
+    u32_t next_index;
+    bool has_next;
+
+    // Notifications queued and not yet sent. Each carries the generation of the transfer that
+    // queued it, so completions still pending from an earlier transfer aren't counted against
+    // this one.
+    atomic_t in_flight;
+    u32_t generation;
+
+    // Throughput
+    s64_t started;
+    u32_t records;
+    u32_t bytes;
+};
+
+// Only touched from the Bluetooth RX thread and the system work queue, which don't preempt each other
+static struct history_transfer transfer = {
+    .end = UINT32_MAX,
+};
+static struct k_work transfer_work;
+
+// The stack copies notification data when queueing it, so one packet buffer is enough
+static u8_t packet[HISTORY_PACKET_MAX];
+
+static void history_control_ccc_cfg_changed(const struct bt_gatt_attr *attr, u16_t value)
+{
+}
+
+static void history_records_ccc_cfg_changed(const struct bt_gatt_attr *attr, u16_t value)
+{
+}
+
+static ssize_t write_history_control(struct bt_conn *conn, const struct bt_gatt_attr *attr, const void *buf, u16_t len, u16_t offset, u8_t flags);
+
+BT_GATT_SERVICE_DEFINE(history,
+    BT_GATT_PRIMARY_SERVICE(&history_service_uuid),
+
+    BT_GATT_CHARACTERISTIC(&history_records_uuid.uuid,
+                   BT_GATT_CHRC_NOTIFY,
+                   BT_GATT_PERM_NONE,
+                   NULL, NULL, NULL),
+    BT_GATT_CCC(history_records_ccc_cfg_changed,
+            BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
+
+    BT_GATT_CHARACTERISTIC(&history_control_uuid.uuid,
+                   BT_GATT_CHRC_WRITE | BT_GATT_CHRC_NOTIFY,
+                   BT_GATT_PERM_WRITE_ENCRYPT,
+                   NULL, write_history_control, NULL),
+    BT_GATT_CCC(history_control_ccc_cfg_changed,
+            BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
+);
+
+#define HISTORY_ATTR_RECORDS (&history.attrs[2])
+#define HISTORY_ATTR_CONTROL (&history.attrs[5])
+
+static inline u64_t history_time_key(u16_t boot, u32_t timestamp)
+{
+    return ((u64_t)boot << 32) | timestamp;
+}
+
+static void history_respond(u8_t opcode, u8_t status)
+{
+    struct bt_conn_info info;
+    u8_t rsp[16];
+    u32_t duration = k_uptime_get() - transfer.started;
+    u32_t events_per_kb = 0;
+
+    // Estimate how many connection events the transfer took from its duration, as the stack
+    // doesn't count them. Intervals are in units of 1.25 ms.
+    if (transfer.bytes > 0 && bt_conn_get_info(transfer.conn, &info) == 0 && info.le.interval > 0) {
+        u32_t events = (duration * 4U) / (info.le.interval * 5U);
+
+        events_per_kb = (events * 1024U) / transfer.bytes;
+    }
+
+    rsp[0] = HISTORY_OP_RESPONSE | opcode;
+    rsp[1] = status;
+    sys_put_le32(transfer.has_next ? transfer.next_index : flash_log_iter_index(&transfer.iter), &rsp[2]);
+    sys_put_le32(transfer.records, &rsp[6]);
+    sys_put_le32(duration, &rsp[10]);
+    sys_put_le16(MIN(events_per_kb, 0xFFFF), &rsp[14]);
+
+    if (bt_gatt_is_subscribed(transfer.conn, HISTORY_ATTR_CONTROL, BT_GATT_CCC_NOTIFY)) {
+        bt_gatt_notify(transfer.conn, HISTORY_ATTR_CONTROL, rsp, sizeof(rsp));
+    }
+
+    if (transfer.records > 0 && duration > 0) {
+        LOG_INF("Sent %u records in %u ms (%u records/s, %u connection events/KB)",
+                transfer.records, duration, (transfer.records * 1000U) / duration, events_per_kb);
+    }
+}
+
+static void history_finish(u8_t status)
+{
+    if (!transfer.active) {
+        return;
+    }
+
+    transfer.active = false;
+    history_respond(transfer.opcode, status);
+    connection_set_fast(transfer.conn, false);
+
+    bt_conn_unref(transfer.conn);
+    transfer.conn = NULL;
+}
+
+// Next record of the requested range, returns 1 if there is one
+static int history_next_record(struct flash_log_record *record, u32_t *index)
+{
+    int ret;
+
+    if (transfer.has_next) {
+        transfer.has_next = false;
+        *record = transfer.next;
+        *index = transfer.next_index;
+        return 1;
+    }
+
+    while ((ret = flash_log_iter_next(&transfer.iter, record)) == 1) {
+        *index = flash_log_iter_index(&transfer.iter) - 1;
+
+        if (*index >= transfer.end) {
+            return 0;
+        }
+
+        if (!transfer.by_time) {
+            return 1;
+        }
+
+        u64_t key = history_time_key(record->boot, record->timestamp);
+        if (key > transfer.time_to) {
+            // The log is in time order, nothing after this can match
+            return 0;
+        }
+        if (key >= transfer.time_from) {
+            return 1;
+        }
+    }
+
+    return ret;
+}
+
+static void history_sent(struct bt_conn *conn, void *user_data)
+{
+    // Late for a transfer that was already restarted
+    if (POINTER_TO_UINT(user_data) != transfer.generation) {
+        return;
+    }
+
+    atomic_dec(&transfer.in_flight);
+    k_work_submit(&transfer_work);
+}
+
+static void history_transfer_handler(struct k_work *work)
+{
+    struct flash_log_record record;
+    u32_t index;
+    int ret = 0;
+
+    if (!transfer.active) {
+        return;
+    }
+
+    // Records that fit in a notification at the negotiated MTU
+    u16_t capacity = (bt_gatt_get_mtu(transfer.conn) - HISTORY_ATT_OVERHEAD - HISTORY_HEADER_SIZE) /
+                     sizeof(struct flash_log_record);
+    capacity = MIN(capacity, CONFIG_APP_HISTORY_TX_RECORDS);
+
+    // Keep the controller's queue full so every connection event carries as many packets as it can
+    while (atomic_get(&transfer.in_flight) < CONFIG_APP_HISTORY_TX_WINDOW) {
+        u16_t count = 0;
+        u32_t first = 0;
+
+        while (count < capacity && (ret = history_next_record(&record, &index)) == 1) {
+            if (count == 0) {
+                first = index;
+            } else if (index != first + count) {
+                // Records are consecutive within a packet, a gap starts the next one
+                transfer.next = record;
+                transfer.next_index = index;
+                transfer.has_next = true;
+                break;
+            }
+
+            memcpy(&packet[HISTORY_HEADER_SIZE + (count * sizeof(record))], &record, sizeof(record));
+            count++;
+        }
+
+        if (count == 0) {
+            if (ret < 0) {
+                LOG_ERR("Failed to read the log (Error %d)", ret);
+                history_finish(HISTORY_STATUS_FAILED);
+            } else if (atomic_get(&transfer.in_flight) == 0) {
+                history_finish(HISTORY_STATUS_SUCCESS);
+            }
+            return;
+        }
+
+        sys_put_le32(first, packet);
+
+        struct bt_gatt_notify_params params = {
+            .attr = HISTORY_ATTR_RECORDS,
+            .data = packet,
+            .len = HISTORY_HEADER_SIZE + (count * sizeof(record)),
+            .func = history_sent,
+            .user_data = UINT_TO_POINTER(transfer.generation),
+        };
+
+        atomic_inc(&transfer.in_flight);
+
+        ret = bt_gatt_notify_cb(transfer.conn, &params);
+        if (ret) {
+            // Put the records back so the resume token still points at the first unsent one
+            atomic_dec(&transfer.in_flight);
+            flash_log_iter_seek(&transfer.iter, first);
+            transfer.has_next = false;
+
+            LOG_WRN("Transfer stopped (Error %d)", ret);
+            history_finish(HISTORY_STATUS_FAILED);
+            return;
+        }
+
+        transfer.records += count;
+        transfer.bytes += params.len;
+    }
+}
+
+static void history_start(struct bt_conn *conn, u8_t opcode, u32_t first)
+{
+    transfer.conn = bt_conn_ref(conn);
+    transfer.opcode = opcode;
+    transfer.has_next = false;
+    transfer.records = 0;
+    transfer.bytes = 0;
+    transfer.started = k_uptime_get();
+    transfer.generation++;
+    atomic_set(&transfer.in_flight, 0);
+
+    if (opcode == HISTORY_OP_REQUEST_TIME) {
+        flash_log_iter_init(&transfer.iter);
+    } else {
+        flash_log_iter_seek(&transfer.iter, first);
+    }
+
+    transfer.active = true;
+    connection_set_fast(conn, true);
+    k_work_submit(&transfer_work);
+}
+
+static ssize_t write_history_control(struct bt_conn *conn, const struct bt_gatt_attr *attr, const void *buf, u16_t len, u16_t offset, u8_t flags)
+{
+    const u8_t *req = buf;
+
+    if (offset != 0) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+
+    if (len < 1) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    if (!bt_gatt_is_subscribed(conn, HISTORY_ATTR_RECORDS, BT_GATT_CCC_NOTIFY) ||
+        !bt_gatt_is_subscribed(conn, HISTORY_ATTR_CONTROL, BT_GATT_CCC_NOTIFY)) {
+        return BT_GATT_ERR(BT_ATT_ERR_CCC_IMPROPER_CONF);
+    }
+
+    if (req[0] == HISTORY_OP_ABORT) {
+        if (transfer.active && transfer.conn == conn) {
+            history_finish(HISTORY_STATUS_ABORTED);
+        }
+        return len;
+    }
+
+    if (transfer.active) {
+        return BT_GATT_ERR(BT_ATT_ERR_PROCEDURE_IN_PROGRESS);
+    }
+
+    switch (req[0]) {
+        case HISTORY_OP_REQUEST_INDEX: {
+            if (len != 9) {
+                return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+            }
+
+            u32_t first = sys_get_le32(&req[1]);
+            u32_t count = sys_get_le32(&req[5]);
+
+            transfer.by_time = false;
+            transfer.end = (count == 0 || first + count < first) ? UINT32_MAX : first + count;
+            history_start(conn, req[0], first);
+            break;
+        }
+        case HISTORY_OP_REQUEST_TIME: {
+            if (len != 13) {
+                return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+            }
+
+            transfer.by_time = true;
+            transfer.end = UINT32_MAX;
+            transfer.time_from = history_time_key(sys_get_le16(&req[1]), sys_get_le32(&req[3]));
+            transfer.time_to = history_time_key(sys_get_le16(&req[7]), sys_get_le32(&req[9]));
+            if (transfer.time_from > transfer.time_to) {
+                return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+            }
+            history_start(conn, req[0], 0);
+            break;
+        }
+        case HISTORY_OP_RESUME:
+            if (len != 5) {
+                return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+            }
+
+            // Carry on with the end condition of the interrupted request
+            history_start(conn, req[0], sys_get_le32(&req[1]));
+            break;
+        default:
+            return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+    }
+
+    return len;
+}
+
+static struct bt_gatt_exchange_params exchange_params[CONFIG_BT_MAX_CONN];
+
+static void history_mtu_exchanged(struct bt_conn *conn, u8_t err, struct bt_gatt_exchange_params *params)
+{
+    LOG_DBG("MTU exchange %s, MTU %u", err ? "failed" : "done", bt_gatt_get_mtu(conn));
+}
+
+static void history_connected(struct bt_conn *conn, u8_t err)
+{
+    if (err) {
+        return;
+    }
+
+    // The default MTU only fits a single record per notification
+    struct bt_gatt_exchange_params *params = &exchange_params[bt_conn_index(conn)];
+
+    params->func = history_mtu_exchanged;
+    bt_gatt_exchange_mtu(conn, params);
+}
+
+static void history_disconnected(struct bt_conn *conn, u8_t reason)
+{
+    if (transfer.active && transfer.conn == conn) {
+        // The client picks this up again with the index following the last record it received
+        transfer.active = false;
+        LOG_INF("Transfer interrupted after %u records", transfer.records);
+
+        bt_conn_unref(transfer.conn);
+        transfer.conn = NULL;
+    }
+}
+
+static struct bt_conn_cb history_connection_callbacks = {
+    .connected = history_connected,
+    .disconnected = history_disconnected,
+};
+
+static int bluetooth_history_init(struct device *dev)
+{
+    ARG_UNUSED(dev);
+
+    k_work_init(&transfer_work, history_transfer_handler);
+    bt_conn_cb_register(&history_connection_callbacks);
+
+    return 0;
+}
+
+SYS_INIT(bluetooth_history_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,318 @@
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/byteorder.h>
+#include <zephyr.h>
+#include <init.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/uuid.h>
+#include <bluetooth/gatt.h>
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(bluetooth_snapshot_service, LOG_LEVEL_INF);
+
+#include "bluetooth.h"
+
+// All channels of a sample in a single characteristic, for gateways that want everything.
+//
+// A snapshot record is
+//
+//   u16 sequence | s16 temperature (0.01 degC) | u16 humidity (0.01 %RH) | u8 battery (%)
+//
+// all little endian. The sequence number counts samples, so a gap shows a lost one. Reading the
+// Snapshot characteristic returns the latest record. Subscribers receive notifications holding
+// as many records as set in the Batch characteristic (1 by default, per connection), so several
+// samples share a single packet and connection event. A batch larger than the MTU allows goes out
+// as several notifications.
+//
+// Like the notification queue, the service keeps at most CONFIG_APP_SNAPSHOT_IN_FLIGHT
+// notifications in the stack and sends the next one when the stack reports the last one sent.
+
+#define SNAPSHOT_RECORD_SIZE 7
+
+// ATT notification header size
+#define SNAPSHOT_ATT_OVERHEAD 3
+
+static struct bt_uuid_128 snapshot_service_uuid = BT_UUID_INIT_128(
+    0x5a, 0x1d, 0x2c, 0x5b, 0x6e, 0x3f, 0x4a, 0x8e,
+    0x9d, 0x41, 0x7b, 0x10, 0x10, 0x00, 0x4d, 0x54);
+
+static struct bt_uuid_128 snapshot_records_uuid = BT_UUID_INIT_128(
+    0x5a, 0x1d, 0x2c, 0x5b, 0x6e, 0x3f, 0x4a, 0x8e,
+    0x9d, 0x41, 0x7b, 0x10, 0x11, 0x00, 0x4d, 0x54);
+
+static struct bt_uuid_128 snapshot_batch_uuid = BT_UUID_INIT_128(
+    0x5a, 0x1d, 0x2c, 0x5b, 0x6e, 0x3f, 0x4a, 0x8e,
+    0x9d, 0x41, 0x7b, 0x10, 0x12, 0x00, 0x4d, 0x54);
+
+// Samples waiting for a connection, indexed by bt_conn_index()
+struct snapshot_peer {
+    struct bt_conn *conn;
+    u8_t batch;
+    u8_t count;
+    // Notifications handed to the stack and not sent yet
+    u8_t in_flight;
+    u8_t records[CONFIG_APP_SNAPSHOT_BATCH_MAX * SNAPSHOT_RECORD_SIZE];
+};
+
+static struct snapshot_peer peers[CONFIG_BT_MAX_CONN];
+
+static u8_t latest[SNAPSHOT_RECORD_SIZE];
+static u16_t sequence;
+static u8_t in_flight;
+
+// Samples dropped because a batch couldn't be sent before the buffer filled up
+static u32_t dropped;
+
+static K_MUTEX_DEFINE(snapshot_lock);
+static struct k_work snapshot_work;
+
+static ssize_t read_snapshot(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf, u16_t len, u16_t offset)
+{
+    u8_t record[SNAPSHOT_RECORD_SIZE];
+
+    k_mutex_lock(&snapshot_lock, K_FOREVER);
+    memcpy(record, latest, sizeof(record));
+    k_mutex_unlock(&snapshot_lock);
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, record, sizeof(record));
+}
+
+static ssize_t read_snapshot_batch(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf, u16_t len, u16_t offset)
+{
+    const struct snapshot_peer *peer = &peers[bt_conn_index(conn)];
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &peer->batch, sizeof(peer->batch));
+}
+
+static ssize_t write_snapshot_batch(struct bt_conn *conn, const struct bt_gatt_attr *attr, const void *buf, u16_t len, u16_t offset, u8_t flags)
+{
+    struct snapshot_peer *peer = &peers[bt_conn_index(conn)];
+
+    if (offset != 0) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+
+    if (len != sizeof(peer->batch)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    u8_t batch = *(const u8_t *)buf;
+
+    if (batch == 0 || batch > CONFIG_APP_SNAPSHOT_BATCH_MAX) {
+        return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+    }
+
+    k_mutex_lock(&snapshot_lock, K_FOREVER);
+    peer->batch = batch;
+    k_mutex_unlock(&snapshot_lock);
+
+    LOG_DBG("Batches of %u samples for connection %u", batch, bt_conn_index(conn));
+
+    // A smaller batch may already be complete
+    k_work_submit(&snapshot_work);
+
+    return len;
+}
+
+static void snapshot_ccc_cfg_changed(const struct bt_gatt_attr *attr, u16_t value)
+{
+}
+
+BT_GATT_SERVICE_DEFINE(snapshot,
+    BT_GATT_PRIMARY_SERVICE(&snapshot_service_uuid),
+
+    BT_GATT_CHARACTERISTIC(&snapshot_records_uuid.uuid,
+                   BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+                   BT_GATT_PERM_READ_ENCRYPT,
+                   read_snapshot, NULL, NULL),
+    BT_GATT_CCC(snapshot_ccc_cfg_changed,
+            BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
+
+    BT_GATT_CHARACTERISTIC(&snapshot_batch_uuid.uuid,
+                   BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                   BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT,
+                   read_snapshot_batch, write_snapshot_batch, NULL),
+);
+
+#define SNAPSHOT_ATTR_RECORDS (&snapshot.attrs[2])
+
+static void snapshot_sent(struct bt_conn *conn, void *user_data)
+{
+    struct snapshot_peer *peer = &peers[bt_conn_index(conn)];
+
+    k_mutex_lock(&snapshot_lock, K_FOREVER);
+
+    // Already released if the connection went down
+    if (peer->conn == conn && peer->in_flight > 0) {
+        peer->in_flight--;
+        in_flight--;
+    }
+
+    k_mutex_unlock(&snapshot_lock);
+
+    k_work_submit(&snapshot_work);
+}
+
+// Send every complete batch, as many records per notification as the MTU allows. The records are
+// taken out under the lock and sent after releasing it, as bt_gatt_notify_cb() may wait for
+// buffers.
+static void snapshot_work_handler(struct k_work *work)
+{
+    u8_t records[CONFIG_APP_SNAPSHOT_BATCH_MAX * SNAPSHOT_RECORD_SIZE];
+
+    for (int i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+        struct snapshot_peer *peer = &peers[i];
+
+        for (;;) {
+            k_mutex_lock(&snapshot_lock, K_FOREVER);
+
+            if (peer->conn == NULL || in_flight >= CONFIG_APP_SNAPSHOT_IN_FLIGHT) {
+                k_mutex_unlock(&snapshot_lock);
+                break;
+            }
+
+            u8_t fits = (bt_gatt_get_mtu(peer->conn) - SNAPSHOT_ATT_OVERHEAD) / SNAPSHOT_RECORD_SIZE;
+            u8_t count = MIN(peer->count, fits);
+
+            if (count == 0 || count < MIN(peer->batch, fits)) {
+                k_mutex_unlock(&snapshot_lock);
+                break;
+            }
+
+            struct bt_conn *conn = bt_conn_ref(peer->conn);
+            struct bt_gatt_notify_params params = {
+                .attr = SNAPSHOT_ATTR_RECORDS,
+                .data = records,
+                .len = count * SNAPSHOT_RECORD_SIZE,
+                .func = snapshot_sent,
+            };
+
+            memcpy(records, peer->records, count * SNAPSHOT_RECORD_SIZE);
+            peer->count -= count;
+            memmove(peer->records, &peer->records[count * SNAPSHOT_RECORD_SIZE], peer->count * SNAPSHOT_RECORD_SIZE);
+            peer->in_flight++;
+            in_flight++;
+
+            k_mutex_unlock(&snapshot_lock);
+
+            int err = bt_gatt_notify_cb(conn, &params);
+            if (err) {
+                LOG_DBG("Failed to send %u samples (Error %d)", count, err);
+
+                k_mutex_lock(&snapshot_lock, K_FOREVER);
+
+                // Put back for the next sample, ahead of any taken meanwhile. The oldest ones go
+                // first if it doesn't recover.
+                if (peer->conn == conn) {
+                    u8_t lost = MAX(peer->count + count - CONFIG_APP_SNAPSHOT_BATCH_MAX, 0);
+                    u8_t kept = count - lost;
+
+                    memmove(&peer->records[kept * SNAPSHOT_RECORD_SIZE], peer->records, peer->count * SNAPSHOT_RECORD_SIZE);
+                    memcpy(peer->records, &records[lost * SNAPSHOT_RECORD_SIZE], kept * SNAPSHOT_RECORD_SIZE);
+                    peer->count += kept;
+                    peer->in_flight--;
+                    in_flight--;
+                    dropped += lost;
+                }
+
+                k_mutex_unlock(&snapshot_lock);
+            }
+
+            bt_conn_unref(conn);
+
+            if (err) {
+                break;
+            }
+        }
+    }
+}
+
+void bluetooth_update_snapshot(const struct measurement *measurement)
+{
+    bool ready = false;
+
+    k_mutex_lock(&snapshot_lock, K_FOREVER);
+
+    sys_put_le16(sequence++, &latest[0]);
+    sys_put_le16(measurement->temperature, &latest[2]);
+    sys_put_le16(measurement->humidity, &latest[4]);
+    latest[6] = measurement->battery;
+
+    for (int i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+        struct snapshot_peer *peer = &peers[i];
+
+        if (peer->conn == NULL || !bt_gatt_is_subscribed(peer->conn, SNAPSHOT_ATTR_RECORDS, BT_GATT_CCC_NOTIFY)) {
+            continue;
+        }
+
+        if (peer->count == CONFIG_APP_SNAPSHOT_BATCH_MAX) {
+            memmove(peer->records, &peer->records[SNAPSHOT_RECORD_SIZE], (peer->count - 1) * SNAPSHOT_RECORD_SIZE);
+            peer->count--;
+            dropped++;
+            LOG_WRN("Connection %d not keeping up, %u samples dropped", i, dropped);
+        }
+
+        memcpy(&peer->records[peer->count * SNAPSHOT_RECORD_SIZE], latest, SNAPSHOT_RECORD_SIZE);
+        peer->count++;
+
+        ready |= peer->count >= peer->batch;
+    }
+
+    k_mutex_unlock(&snapshot_lock);
+
+    // Sent from the work queue, so the sampling path never waits for buffers
+    if (ready) {
+        k_work_submit(&snapshot_work);
+    }
+}
+
+static void snapshot_connected(struct bt_conn *conn, u8_t err)
+{
+    if (err) {
+        return;
+    }
+
+    struct snapshot_peer *peer = &peers[bt_conn_index(conn)];
+
+    k_mutex_lock(&snapshot_lock, K_FOREVER);
+    peer->conn = conn;
+    peer->batch = 1;
+    peer->count = 0;
+    peer->in_flight = 0;
+    k_mutex_unlock(&snapshot_lock);
+}
+
+static void snapshot_disconnected(struct bt_conn *conn, u8_t reason)
+{
+    struct snapshot_peer *peer = &peers[bt_conn_index(conn)];
+
+    k_mutex_lock(&snapshot_lock, K_FOREVER);
+    if (peer->conn == conn) {
+        peer->conn = NULL;
+        peer->count = 0;
+        in_flight -= peer->in_flight;
+        peer->in_flight = 0;
+    }
+    k_mutex_unlock(&snapshot_lock);
+}
+
+static struct bt_conn_cb snapshot_connection_callbacks = {
+    .connected = snapshot_connected,
+    .disconnected = snapshot_disconnected,
+};
+
+static int bluetooth_snapshot_init(struct device *dev)
+{
+    ARG_UNUSED(dev);
+
+    k_work_init(&snapshot_work, snapshot_work_handler);
+    bt_conn_cb_register(&snapshot_connection_callbacks);
+
+    return 0;
+}
+
+SYS_INIT(bluetooth_snapshot_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
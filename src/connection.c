@@ -0,0 +1,294 @@
+#include <zephyr.h>
+#include <init.h>
+#include <shell/shell.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(connection, LOG_LEVEL_INF);
+
+#include "connection.h"
+
+// The central picks the initial parameters, usually a 7.5 - 50 ms interval without latency, which
+// keeps the radio busy even when nothing is sent. Requests are made through
+// bt_conn_le_param_update(); whether the central went along with them only shows in the
+// le_param_updated callback, so a request without a matching update in time counts as rejected.
+
+// Connection interval in 1.25 ms units and supervision timeout in 10 ms units
+#define CONNECTION_INTERVAL(ms) (((ms) * 4) / 5)
+#define CONNECTION_TIMEOUT(ms)  ((ms) / 10)
+
+#define CONNECTION_FAST_TIMEOUT_MS  4000
+
+// Time the central gets to answer a request
+#define CONNECTION_RESPONSE_TIMEOUT 10
+
+enum connection_profile {
+    CONNECTION_PROFILE_NONE,
+    CONNECTION_PROFILE_SLOW,
+    CONNECTION_PROFILE_FAST,
+    CONNECTION_PROFILE_COUNT,
+};
+
+static const char *const connection_profile_names[CONNECTION_PROFILE_COUNT] = {
+    [CONNECTION_PROFILE_NONE] = "central's",
+    [CONNECTION_PROFILE_SLOW] = "slow",
+    [CONNECTION_PROFILE_FAST] = "fast",
+};
+
+static const struct bt_le_conn_param connection_profiles[CONNECTION_PROFILE_COUNT] = {
+    [CONNECTION_PROFILE_SLOW] = {
+        .interval_min = CONNECTION_INTERVAL(CONFIG_APP_CONN_SLOW_INTERVAL_MIN),
+        .interval_max = CONNECTION_INTERVAL(CONFIG_APP_CONN_SLOW_INTERVAL_MAX),
+        .latency = CONFIG_APP_CONN_SLOW_LATENCY,
+        .timeout = CONNECTION_TIMEOUT(CONFIG_APP_CONN_SLOW_TIMEOUT),
+    },
+    [CONNECTION_PROFILE_FAST] = {
+        .interval_min = CONNECTION_INTERVAL(CONFIG_APP_CONN_FAST_INTERVAL_MIN),
+        .interval_max = CONNECTION_INTERVAL(CONFIG_APP_CONN_FAST_INTERVAL_MAX),
+        .latency = 0,
+        .timeout = CONNECTION_TIMEOUT(CONNECTION_FAST_TIMEOUT_MS),
+    },
+};
+
+struct connection {
+    struct bt_conn *conn;
+    // Requests a profile change, and gives up waiting for the answer to one
+    struct k_delayed_work update_work;
+    struct k_delayed_work timeout_work;
+    // Profile in use and the one asked for
+    enum connection_profile current;
+    enum connection_profile requested;
+    bool pending;
+    bool secured;
+    bool fast;
+};
+
+static struct connection connections[CONFIG_BT_MAX_CONN];
+
+// Outcome of the requests per profile, and the last parameters seen for each outcome
+static u32_t accepted[CONNECTION_PROFILE_COUNT];
+static u32_t rejected[CONNECTION_PROFILE_COUNT];
+static struct bt_le_conn_param last_accepted;
+static struct bt_le_conn_param last_rejected;
+
+static struct connection *connection_get(struct bt_conn *conn)
+{
+    struct connection *c = &connections[bt_conn_index(conn)];
+
+    return (c->conn == conn) ? c : NULL;
+}
+
+static void connection_request(struct connection *c, enum connection_profile profile)
+{
+    const struct bt_le_conn_param *param = &connection_profiles[profile];
+    int err;
+
+    c->requested = profile;
+
+    err = bt_conn_le_param_update(c->conn, param);
+    if (err) {
+        LOG_WRN("Failed to request the %s profile (Error %d)", connection_profile_names[profile], err);
+        rejected[profile]++;
+        last_rejected = *param;
+        return;
+    }
+
+    c->pending = true;
+    k_delayed_work_submit(&c->timeout_work, K_SECONDS(CONNECTION_RESPONSE_TIMEOUT));
+
+    LOG_DBG("Requested the %s profile", connection_profile_names[profile]);
+}
+
+static void connection_update_handler(struct k_work *work)
+{
+    struct connection *c = CONTAINER_OF(work, struct connection, update_work.work);
+
+    if (c->conn == NULL) {
+        return;
+    }
+
+    enum connection_profile profile = c->fast ? CONNECTION_PROFILE_FAST : CONNECTION_PROFILE_SLOW;
+
+    if (profile != c->current) {
+        connection_request(c, profile);
+    }
+}
+
+static void connection_timeout_handler(struct k_work *work)
+{
+    struct connection *c = CONTAINER_OF(work, struct connection, timeout_work.work);
+
+    if (c->conn == NULL || !c->pending) {
+        return;
+    }
+
+    c->pending = false;
+    rejected[c->requested]++;
+    last_rejected = connection_profiles[c->requested];
+
+    LOG_WRN("No answer to the %s profile request", connection_profile_names[c->requested]);
+}
+
+void connection_set_fast(struct bt_conn *conn, bool fast)
+{
+    struct connection *c = connection_get(conn);
+
+    if (c == NULL || c->fast == fast) {
+        return;
+    }
+
+    c->fast = fast;
+
+    // Going back to slow before the link is secured is left to the delayed request
+    if (fast || c->secured) {
+        k_delayed_work_submit(&c->update_work, K_NO_WAIT);
+    }
+}
+
+static void connection_connected(struct bt_conn *conn, u8_t err)
+{
+    if (err) {
+        return;
+    }
+
+    struct connection *c = &connections[bt_conn_index(conn)];
+
+    c->conn = conn;
+    c->current = CONNECTION_PROFILE_NONE;
+    c->requested = CONNECTION_PROFILE_NONE;
+    c->pending = false;
+    c->secured = false;
+    c->fast = false;
+}
+
+static void connection_disconnected(struct bt_conn *conn, u8_t reason)
+{
+    struct connection *c = connection_get(conn);
+
+    if (c == NULL) {
+        return;
+    }
+
+    k_delayed_work_cancel(&c->update_work);
+    k_delayed_work_cancel(&c->timeout_work);
+    c->conn = NULL;
+}
+
+static void connection_security_changed(struct bt_conn *conn, bt_security_t level, enum bt_security_err err)
+{
+    struct connection *c = connection_get(conn);
+
+    if (c == NULL || err || level < BT_SECURITY_L2 || c->secured) {
+        return;
+    }
+
+    // Give the central time to discover services at its own pace first
+    c->secured = true;
+    k_delayed_work_submit(&c->update_work, K_SECONDS(CONFIG_APP_CONN_SLOW_DELAY));
+}
+
+static void connection_param_updated(struct bt_conn *conn, u16_t interval, u16_t latency, u16_t timeout)
+{
+    struct connection *c = connection_get(conn);
+    struct bt_le_conn_param param = {
+        .interval_min = interval,
+        .interval_max = interval,
+        .latency = latency,
+        .timeout = timeout,
+    };
+
+    if (c == NULL) {
+        return;
+    }
+
+    LOG_INF("Parameters updated: interval %u us, latency %u, timeout %u ms",
+            interval * 1250U, latency, timeout * 10U);
+
+    if (!c->pending) {
+        // Changed by the central on its own
+        c->current = CONNECTION_PROFILE_NONE;
+        return;
+    }
+
+    const struct bt_le_conn_param *requested = &connection_profiles[c->requested];
+
+    c->pending = false;
+    k_delayed_work_cancel(&c->timeout_work);
+
+    if (interval >= requested->interval_min && interval <= requested->interval_max &&
+        latency == requested->latency) {
+        c->current = c->requested;
+        accepted[c->requested]++;
+        last_accepted = param;
+    } else {
+        c->current = CONNECTION_PROFILE_NONE;
+        rejected[c->requested]++;
+        last_rejected = param;
+        LOG_WRN("Central did not accept the %s profile", connection_profile_names[c->requested]);
+    }
+
+    // The transfer may have started or ended while waiting
+    if ((c->fast ? CONNECTION_PROFILE_FAST : CONNECTION_PROFILE_SLOW) != c->requested && c->secured) {
+        k_delayed_work_submit(&c->update_work, K_NO_WAIT);
+    }
+}
+
+static struct bt_conn_cb connection_callbacks = {
+    .connected = connection_connected,
+    .disconnected = connection_disconnected,
+    .security_changed = connection_security_changed,
+    .le_param_updated = connection_param_updated,
+};
+
+static void connection_print_param(const struct shell *shell, const char *name, const struct bt_le_conn_param *param)
+{
+    shell_print(shell, "%s: interval %u-%u us, latency %u, timeout %u ms", name,
+                param->interval_min * 1250U, param->interval_max * 1250U, param->latency,
+                param->timeout * 10U);
+}
+
+static int cmd_connection(const struct shell *shell, size_t argc, char **argv)
+{
+    for (int i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+        struct connection *c = &connections[i];
+        struct bt_conn_info info;
+
+        if (c->conn == NULL || bt_conn_get_info(c->conn, &info) != 0) {
+            continue;
+        }
+
+        shell_print(shell, "Connection %d: %s profile%s, interval %u us, latency %u, timeout %u ms", i,
+                    connection_profile_names[c->current], c->pending ? " (request pending)" : "",
+                    info.le.interval * 1250U, info.le.latency, info.le.timeout * 10U);
+    }
+
+    for (int i = CONNECTION_PROFILE_SLOW; i < CONNECTION_PROFILE_COUNT; i++) {
+        shell_print(shell, "%s profile: %u accepted, %u rejected", connection_profile_names[i],
+                    accepted[i], rejected[i]);
+    }
+
+    connection_print_param(shell, "Last accepted", &last_accepted);
+    connection_print_param(shell, "Last rejected", &last_rejected);
+
+    return 0;
+}
+
+SHELL_CMD_REGISTER(connection, NULL, "Connection parameters and profile requests", cmd_connection);
+
+static int connection_init(struct device *dev)
+{
+    ARG_UNUSED(dev);
+
+    for (int i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+        k_delayed_work_init(&connections[i].update_work, connection_update_handler);
+        k_delayed_work_init(&connections[i].timeout_work, connection_timeout_handler);
+    }
+
+    bt_conn_cb_register(&connection_callbacks);
+
+    return 0;
+}
+
+SYS_INIT(connection_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <zephyr/types.h>
+#include <bluetooth/conn.h>
+
+/**
+ * Connection parameter manager. Once a link is secured (and the central
+ * had CONFIG_APP_CONN_SLOW_DELAY seconds for service discovery) a long
+ * interval with slave latency is requested, so an idle gateway connection
+ * costs little more than advertising.
+ */
+
+/**
+ * Switch the connection to the fast profile while a bulk transfer is
+ * running, and back to the slow one once it is done.
+ */
+void connection_set_fast(struct bt_conn *conn, bool fast);
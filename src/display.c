@@ -9,52 +9,159 @@ LOG_MODULE_REGISTER(display, LOG_LEVEL_DBG);
 #include "display.h"
 
 
+#define DISPLAY_SEGMENTS 7
+// Marks a cached segment whose contents are not known yet
+#define DISPLAY_SEGMENT_UNKNOWN -2
+
 static struct device *dev_segment = NULL;
 static u32_t set_symbols = 0;
 
-int display_set_temperature(const struct sensor_value *value)
+// Serialises access to the display between the main loop and the power policy work items
+static K_MUTEX_DEFINE(display_lock);
+
+static enum display_power_policy power_policy = DISPLAY_POWER_ALWAYS_ON;
+static struct k_delayed_work wake_work;
+static struct k_delayed_work sleep_work;
+
+// The power policy work runs on the system work queue, which mustn't wait for a frame to be
+// committed, so it tries again after this long instead
+#define DISPLAY_LOCK_RETRY K_MSEC(5)
+
+// Last value rendered to each segment, so unchanged digits cause no driver work
+static s8_t segment_cache[DISPLAY_SEGMENTS];
+static u8_t frame_depth = 0;
+static bool frame_dirty = false;
+
+void display_begin_frame(void)
+{
+    if (dev_segment == NULL) {
+        return;
+    }
+
+    k_mutex_lock(&display_lock, K_FOREVER);
+
+    if (frame_depth++ == 0) {
+        bu9795_begin_frame(dev_segment);
+    }
+}
+
+void display_commit_frame(void)
+{
+    if (dev_segment == NULL || frame_depth == 0) {
+        return;
+    }
+
+    if (--frame_depth == 0) {
+        if (frame_dirty) {
+            // Don't wait for the transfer, the driver waits for it before touching the bus again
+            bu9795_flush_async(dev_segment);
+            frame_dirty = false;
+        }
+        bu9795_commit_frame(dev_segment);
+    }
+
+    k_mutex_unlock(&display_lock);
+}
+
+static void display_set_segment(int segment, int value)
+{
+    if (segment_cache[segment] == value) {
+        return;
+    }
+
+    bu9795_set_segment(dev_segment, segment, value);
+    segment_cache[segment] = value;
+    frame_dirty = true;
+}
+
+// Glyph of the temperature tens segment showing a minus sign, see boards/xiaomi_bt_sensor_lcd.yaml
+#define DISPLAY_GLYPH_MINUS 10
+
+static void display_blank_digits(int first_segment)
+{
+    display_set_segment(first_segment, -1);
+    display_set_segment(first_segment + 1, -1);
+    display_set_segment(first_segment + 2, -1);
+}
+
+// Show a value in hundredths on the three digit segments starting at first_segment, as
+// tens, units and tenths. A negative value shows a minus sign on the tens segment, which only
+// the temperature has, and drops the tenths from -10 on. Values the display can't show are
+// blanked. Returns whether the decimal point goes with the digits.
+static bool display_set_digits(int first_segment, s32_t centi)
+{
+    u8_t digits[3];
+
+    if (centi <= -10000 || centi >= 10000) {
+        display_blank_digits(first_segment);
+        return false;
+    }
+
+    if (centi >= 0) {
+        measurement_digits(centi, digits);
+
+        display_set_segment(first_segment, digits[0]);
+        display_set_segment(first_segment + 1, digits[1]);
+        display_set_segment(first_segment + 2, digits[2]);
+        return true;
+    }
+
+    measurement_digits(-centi, digits);
+
+    display_set_segment(first_segment, DISPLAY_GLYPH_MINUS);
+
+    if (digits[0] == 0) {
+        // -9.9 to -0.1
+        display_set_segment(first_segment + 1, digits[1]);
+        display_set_segment(first_segment + 2, digits[2]);
+        return true;
+    }
+
+    // -99 to -10, in whole degrees
+    display_set_segment(first_segment + 1, digits[0]);
+    display_set_segment(first_segment + 2, digits[1]);
+    return false;
+}
+
+int display_set_temperature(const struct measurement *value)
 {
     if (dev_segment == NULL) {
         return -ENOENT;
     }
 
+    display_begin_frame();
+
     if (value == NULL) {
-        // TODO: disable decimal point
-        bu9795_set_segment(dev_segment, 0, -1);
-        bu9795_set_segment(dev_segment, 1, -1);
-        bu9795_set_segment(dev_segment, 2, -1);
+        display_blank_digits(0);
         display_clear_symbols(DISPLAY_SYMBOL_TEMPERATURE_DECIMAL);
-    } else {
-        bu9795_set_segment(dev_segment, 0, value->val1 / 10);
-        bu9795_set_segment(dev_segment, 1, value->val1 % 10);
-        bu9795_set_segment(dev_segment, 2, value->val2 / 100000);
+    } else if (display_set_digits(0, value->temperature)) {
         display_set_symbols(DISPLAY_SYMBOL_TEMPERATURE_DECIMAL);
+    } else {
+        display_clear_symbols(DISPLAY_SYMBOL_TEMPERATURE_DECIMAL);
     }
 
-    bu9795_flush(dev_segment);
+    display_commit_frame();
     return 0;
 }
 
-int display_set_humidity(const struct sensor_value *value)
+int display_set_humidity(const struct measurement *value)
 {
     if (dev_segment == NULL) {
         return -ENOENT;
     }
 
+    display_begin_frame();
+
     if (value == NULL) {
-        // TODO: disable decimal point
-        bu9795_set_segment(dev_segment, 3, -1);
-        bu9795_set_segment(dev_segment, 4, -1);
-        bu9795_set_segment(dev_segment, 5, -1);
+        display_blank_digits(3);
         display_clear_symbols(DISPLAY_SYMBOL_HUMIDITY_DECIMAL);
-    } else {
-        bu9795_set_segment(dev_segment, 3, value->val1 / 10);
-        bu9795_set_segment(dev_segment, 4, value->val1 % 10);
-        bu9795_set_segment(dev_segment, 5, value->val2 / 100000);
+    } else if (display_set_digits(3, value->humidity)) {
         display_set_symbols(DISPLAY_SYMBOL_HUMIDITY_DECIMAL);
+    } else {
+        display_clear_symbols(DISPLAY_SYMBOL_HUMIDITY_DECIMAL);
     }
 
-    bu9795_flush(dev_segment);
+    display_commit_frame();
     return 0;
 }
 
@@ -64,21 +171,23 @@ int display_set_battery(int percent)
         return -ENOENT;
     }
 
+    display_begin_frame();
+
     if (percent > 80) {
-        bu9795_set_segment(dev_segment, 6, 6);
+        display_set_segment(6, 6);
     } else if (percent > 60) {
-        bu9795_set_segment(dev_segment, 6, 5);
+        display_set_segment(6, 5);
     } else if (percent > 40) {
-        bu9795_set_segment(dev_segment, 6, 4);
+        display_set_segment(6, 4);
     } else if (percent > 20) {
-        bu9795_set_segment(dev_segment, 6, 3);
+        display_set_segment(6, 3);
     } else if (percent > 0) {
-        bu9795_set_segment(dev_segment, 6, 2);
+        display_set_segment(6, 2);
     } else {
-        bu9795_set_segment(dev_segment, 6, 1);
+        display_set_segment(6, 1);
     }
 
-    bu9795_flush(dev_segment);
+    display_commit_frame();
     return 0;
 }
 
@@ -92,8 +201,10 @@ int display_set_symbols(u8_t symbols)
     }
 
     if (set_symbols != old_symbols) {
+        display_begin_frame();
         bu9795_set_symbol(dev_segment, set_symbols);
-        bu9795_flush(dev_segment);
+        frame_dirty = true;
+        display_commit_frame();
     }
     return 0;
 }
@@ -108,12 +219,102 @@ int display_clear_symbols(u8_t symbols)
     }
 
     if (set_symbols != old_symbols) {
+        display_begin_frame();
         bu9795_set_symbol(dev_segment, set_symbols);
-        bu9795_flush(dev_segment);
+        frame_dirty = true;
+        display_commit_frame();
     }
     return 0;
 }
 
+static int display_apply_power_policy(enum display_power_policy policy, bool awake)
+{
+    enum bu9795_frame_rate rate = BU9795_FRAME_RATE_80HZ;
+    enum bu9795_power_mode mode = BU9795_POWER_NORMAL;
+    bool enabled = true;
+    int err;
+
+    switch (policy) {
+        case DISPLAY_POWER_ALWAYS_ON:
+            break;
+        case DISPLAY_POWER_SAVE:
+            rate = BU9795_FRAME_RATE_53HZ;
+            mode = BU9795_POWER_SAVE_1;
+            break;
+        case DISPLAY_POWER_OFF_UNTIL_BUTTON:
+            enabled = awake;
+            break;
+        default:
+            return -EINVAL;
+    }
+
+    err = bu9795_set_drive_mode(dev_segment, rate, mode);
+    if (err) {
+        return err;
+    }
+
+    return bu9795_set_display_enabled(dev_segment, enabled);
+}
+
+int display_set_power_policy(enum display_power_policy policy)
+{
+    int err;
+
+    if (dev_segment == NULL) {
+        return -ENOENT;
+    }
+
+    k_mutex_lock(&display_lock, K_FOREVER);
+
+    err = display_apply_power_policy(policy, false);
+    if (err) {
+        LOG_ERR("Failed to apply display power policy %d (Error %d)", policy, err);
+    } else {
+        LOG_DBG("Display power policy %d", policy);
+        power_policy = policy;
+    }
+
+    k_mutex_unlock(&display_lock);
+
+    return err;
+}
+
+static void display_wake_handler(struct k_work *work)
+{
+    if (k_mutex_lock(&display_lock, K_NO_WAIT) != 0) {
+        k_delayed_work_submit(&wake_work, DISPLAY_LOCK_RETRY);
+        return;
+    }
+
+    if (power_policy == DISPLAY_POWER_OFF_UNTIL_BUTTON) {
+        display_apply_power_policy(power_policy, true);
+        k_delayed_work_submit(&sleep_work, K_SECONDS(CONFIG_APP_DISPLAY_WAKE_TIME));
+    }
+
+    k_mutex_unlock(&display_lock);
+}
+
+static void display_sleep_handler(struct k_work *work)
+{
+    if (k_mutex_lock(&display_lock, K_NO_WAIT) != 0) {
+        k_delayed_work_submit(&sleep_work, DISPLAY_LOCK_RETRY);
+        return;
+    }
+
+    if (power_policy == DISPLAY_POWER_OFF_UNTIL_BUTTON) {
+        display_apply_power_policy(power_policy, false);
+    }
+
+    k_mutex_unlock(&display_lock);
+}
+
+void display_wake(void)
+{
+    if (dev_segment != NULL && power_policy == DISPLAY_POWER_OFF_UNTIL_BUTTON) {
+        k_delayed_work_submit(&wake_work, K_NO_WAIT);
+    }
+}
+
 static int display_setup(struct device *arg)
 {
 	dev_segment = device_get_binding(DT_ALIAS_SEGMENT0_LABEL);
@@ -123,6 +324,10 @@ static int display_setup(struct device *arg)
     }
     LOG_DBG("Found display device %s", DT_ALIAS_SEGMENT0_LABEL);
 
+    memset(segment_cache, DISPLAY_SEGMENT_UNKNOWN, sizeof(segment_cache));
+
+    display_begin_frame();
+
     display_set_temperature(NULL);
 
     display_clear_symbols(DISPLAY_SYMBOL_ALL);
@@ -130,6 +335,17 @@ static int display_setup(struct device *arg)
     // Default the battery logo to empty
     display_set_battery(0);
 
+    display_commit_frame();
+
+    k_delayed_work_init(&wake_work, display_wake_handler);
+    k_delayed_work_init(&sleep_work, display_sleep_handler);
+
+#if defined(CONFIG_APP_DISPLAY_POWER_SAVE)
+    display_set_power_policy(DISPLAY_POWER_SAVE);
+#elif defined(CONFIG_APP_DISPLAY_POWER_OFF_UNTIL_BUTTON)
+    display_set_power_policy(DISPLAY_POWER_OFF_UNTIL_BUTTON);
+#endif
+
     return 0;
 }
 
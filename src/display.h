@@ -1,7 +1,8 @@
 #pragma once
 
 #include <zephyr/types.h>
-#include <drivers/sensor.h>
+
+#include "measurement.h"
 
 enum display_symbols {
     DISPLAY_SYMBOL_TEMPERATURE_DECIMAL = 0x01,
@@ -14,8 +15,42 @@ enum display_symbols {
 
 };
 
-int display_set_temperature(const struct sensor_value *value);
-int display_set_humidity(const struct sensor_value *value);
+enum display_power_policy {
+    // Normal LCD drive
+    DISPLAY_POWER_ALWAYS_ON,
+    // Lowest LCD drive power and frame rate, e.g. at night
+    DISPLAY_POWER_SAVE,
+    // Display is off until woken with display_wake()
+    DISPLAY_POWER_OFF_UNTIL_BUTTON,
+};
+
+/**
+ * Start a display frame. Updates made until the matching
+ * display_commit_frame() are buffered and sent to the display in a
+ * single transfer. Frames may be nested.
+ *
+ * A frame holds the display lock, which delays waking the display with
+ * the button, so it should only span display updates.
+ */
+void display_begin_frame(void);
+
+/** Finish a display frame, flushing any changes once the outermost frame is closed. */
+void display_commit_frame(void);
+
+/** Show the temperature of @p value, or blank it when NULL. */
+int display_set_temperature(const struct measurement *value);
+/** Show the humidity of @p value, or blank it when NULL. */
+int display_set_humidity(const struct measurement *value);
 int display_set_battery(int percent);
 int display_set_symbols(u8_t symbols);
 int display_clear_symbols(u8_t symbols);
+
+/** Change how the display is powered. */
+int display_set_power_policy(enum display_power_policy policy);
+
+/**
+ * Turn the display on for CONFIG_APP_DISPLAY_WAKE_TIME seconds when it's
+ * off because of the DISPLAY_POWER_OFF_UNTIL_BUTTON policy. Safe to call
+ * from an interrupt.
+ */
+void display_wake(void);
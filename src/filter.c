@@ -0,0 +1,115 @@
+#include <zephyr.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(filter, LOG_LEVEL_INF);
+
+#include "filter.h"
+
+// All filtering is integer only, the M0 has neither an FPU nor a divider
+
+struct filter_channel {
+    bool primed;
+#if defined(CONFIG_APP_FILTER_EMA)
+    // Average scaled up by 2^CONFIG_APP_FILTER_EMA_SHIFT to keep the fractional part
+    s32_t average;
+#elif defined(CONFIG_APP_FILTER_MEDIAN)
+    s32_t window[CONFIG_APP_FILTER_MEDIAN_SIZE];
+    u8_t count;
+    u8_t next;
+#endif
+    // Last value let through the deadband
+    s32_t output;
+};
+
+static struct filter_channel temperature;
+static struct filter_channel humidity;
+static struct measurement last_raw;
+
+#if defined(CONFIG_APP_FILTER_EMA)
+
+static s32_t filter_apply(struct filter_channel *channel, s32_t value)
+{
+    if (!channel->primed) {
+        channel->average = value * (1 << CONFIG_APP_FILTER_EMA_SHIFT);
+    } else {
+        channel->average += value - (channel->average >> CONFIG_APP_FILTER_EMA_SHIFT);
+    }
+
+    // Round to the nearest hundredth
+    return (channel->average + BIT(CONFIG_APP_FILTER_EMA_SHIFT - 1)) >> CONFIG_APP_FILTER_EMA_SHIFT;
+}
+
+#elif defined(CONFIG_APP_FILTER_MEDIAN)
+
+static s32_t filter_apply(struct filter_channel *channel, s32_t value)
+{
+    s32_t sorted[CONFIG_APP_FILTER_MEDIAN_SIZE];
+
+    channel->window[channel->next] = value;
+    if (++channel->next == CONFIG_APP_FILTER_MEDIAN_SIZE) {
+        channel->next = 0;
+    }
+    if (channel->count < CONFIG_APP_FILTER_MEDIAN_SIZE) {
+        channel->count++;
+    }
+
+    // Insertion sort, the window is tiny
+    for (int i = 0; i < channel->count; i++) {
+        s32_t v = channel->window[i];
+        int j = i;
+
+        while (j > 0 && sorted[j - 1] > v) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = v;
+    }
+
+    return sorted[channel->count >> 1];
+}
+
+#else
+
+static s32_t filter_apply(struct filter_channel *channel, s32_t value)
+{
+    return value;
+}
+
+#endif
+
+static s32_t filter_channel_update(struct filter_channel *channel, s32_t value)
+{
+    s32_t filtered = filter_apply(channel, value);
+
+    if (!channel->primed || abs(filtered - channel->output) > CONFIG_APP_FILTER_DEADBAND) {
+        channel->output = filtered;
+    }
+
+    channel->primed = true;
+
+    return channel->output;
+}
+
+void filter_update(const struct measurement *raw, struct measurement *filtered)
+{
+    last_raw = *raw;
+
+    filtered->temperature = filter_channel_update(&temperature, last_raw.temperature);
+    filtered->humidity = filter_channel_update(&humidity, last_raw.humidity);
+
+    LOG_DBG("Raw %d/%u, filtered %d/%u", last_raw.temperature, last_raw.humidity,
+            filtered->temperature, filtered->humidity);
+}
+
+const struct measurement *filter_raw(void)
+{
+    return &last_raw;
+}
+
+void filter_reset(void)
+{
+    memset(&temperature, 0, sizeof(temperature));
+    memset(&humidity, 0, sizeof(humidity));
+}
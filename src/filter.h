@@ -0,0 +1,21 @@
+#pragma once
+
+#include "measurement.h"
+
+/**
+ * Run a reading through the noise filter selected with CONFIG_APP_FILTER.
+ *
+ * The deadband (CONFIG_APP_FILTER_DEADBAND) is applied to the filter
+ * output, so small wobbles around a stable value don't reach the display
+ * or the radio at all.
+ *
+ * @param raw the reading as it came from the sensor.
+ * @param filtered where to store the filtered reading, may be @p raw.
+ */
+void filter_update(const struct measurement *raw, struct measurement *filtered);
+
+/** Last unfiltered reading passed to filter_update(). */
+const struct measurement *filter_raw(void);
+
+/** Forget the filter history, e.g. after the sensor mode changed. */
+void filter_reset(void);
@@ -0,0 +1,407 @@
+#include <zephyr.h>
+#include <init.h>
+#include <string.h>
+#include <storage/flash_map.h>
+#include <sys/crc.h>
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(flash_log, LOG_LEVEL_INF);
+
+#include "flash_log.h"
+
+// The log partition is used as a ring of flash sectors. Every sector starts with a header
+// holding a sequence number, followed by fixed size records appended in order. When the newest
+// sector fills up, the sector after it (holding the oldest records) is erased and becomes the
+// newest one, which spreads erases evenly over the partition.
+//
+// At boot only the sector headers are read, the end of the newest sector is then found with a
+// binary search: records are written in order, so written slots all come before erased ones.
+
+#define FLASH_LOG_MAGIC 0x4D4C4F47
+#define FLASH_LOG_SEQ_INVALID 0xFFFFFFFF
+#define FLASH_LOG_MAX_SECTORS 32
+
+struct flash_log_sector_header {
+    u32_t magic;
+    u32_t seq;
+};
+
+#define FLASH_LOG_SLOTS ((CONFIG_APP_FLASH_LOG_SECTOR_SIZE - sizeof(struct flash_log_sector_header)) / sizeof(struct flash_log_record))
+
+static const struct flash_area *fa;
+static u8_t sector_count;
+
+// Sequence number of every sector, or FLASH_LOG_SEQ_INVALID if it holds no log
+static u32_t sector_seq[FLASH_LOG_MAX_SECTORS];
+
+// Newest sector and the number of slots written in it
+static u8_t active;
+static u16_t active_slots;
+
+static struct flash_log_record pending[CONFIG_APP_FLASH_LOG_BATCH];
+static u8_t pending_count;
+
+static u16_t boot;
+
+static K_MUTEX_DEFINE(flash_log_lock);
+
+static inline off_t flash_log_offset(u8_t sector, u16_t slot)
+{
+    return (sector * CONFIG_APP_FLASH_LOG_SECTOR_SIZE) + sizeof(struct flash_log_sector_header) +
+           (slot * sizeof(struct flash_log_record));
+}
+
+static u8_t flash_log_crc(const struct flash_log_record *record)
+{
+    return crc8_ccitt(0xFF, record, offsetof(struct flash_log_record, crc));
+}
+
+static bool flash_log_erased(const struct flash_log_record *record)
+{
+    const u8_t *bytes = (const u8_t *)record;
+
+    for (size_t i = 0; i < sizeof(*record); i++) {
+        if (bytes[i] != 0xFF) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int flash_log_read(u8_t sector, u16_t slot, struct flash_log_record *record)
+{
+    return flash_area_read(fa, flash_log_offset(sector, slot), record, sizeof(*record));
+}
+
+// Sector holding the given sequence number, or -1 if it has been recycled
+static int flash_log_sector(u32_t seq)
+{
+    for (int i = 0; i < sector_count; i++) {
+        if (sector_seq[i] == seq) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Oldest sequence number still held that is not older than seq
+static u32_t flash_log_oldest_seq(u32_t seq)
+{
+    u32_t oldest = FLASH_LOG_SEQ_INVALID;
+
+    for (int i = 0; i < sector_count; i++) {
+        if (sector_seq[i] >= seq && sector_seq[i] < oldest) {
+            oldest = sector_seq[i];
+        }
+    }
+
+    return oldest;
+}
+
+static int flash_log_start_sector(u8_t sector, u32_t seq)
+{
+    struct flash_log_sector_header header = {
+        .magic = FLASH_LOG_MAGIC,
+        .seq = seq,
+    };
+    int err;
+
+    // Forget the old contents first, a reader must not follow it while it's being erased
+    sector_seq[sector] = FLASH_LOG_SEQ_INVALID;
+
+    err = flash_area_erase(fa, sector * CONFIG_APP_FLASH_LOG_SECTOR_SIZE, CONFIG_APP_FLASH_LOG_SECTOR_SIZE);
+    if (err) {
+        return err;
+    }
+
+    err = flash_area_write(fa, sector * CONFIG_APP_FLASH_LOG_SECTOR_SIZE, &header, sizeof(header));
+    if (err) {
+        return err;
+    }
+
+    sector_seq[sector] = seq;
+    active = sector;
+    active_slots = 0;
+
+    LOG_DBG("Sector %u started, sequence %u", sector, seq);
+
+    return 0;
+}
+
+static int flash_log_write_pending(void)
+{
+    u8_t written = 0;
+    int err;
+
+    while (written < pending_count) {
+        if (active_slots == FLASH_LOG_SLOTS) {
+            u8_t next = (active + 1 == sector_count) ? 0 : active + 1;
+
+            err = flash_log_start_sector(next, sector_seq[active] + 1);
+            if (err) {
+                return err;
+            }
+        }
+
+        // Write as many records as fit in the sector in one go
+        u8_t run = MIN(pending_count - written, FLASH_LOG_SLOTS - active_slots);
+
+        err = flash_area_write(fa, flash_log_offset(active, active_slots), &pending[written],
+                               run * sizeof(struct flash_log_record));
+        if (err) {
+            // Part of the run may have been written, and those slots can't be written again. Close
+            // the sector so the next records go to a fresh one, which keeps written slots ahead of
+            // erased ones for the search at boot. Readers skip the slots left behind by their CRC.
+            active_slots = FLASH_LOG_SLOTS;
+            return err;
+        }
+
+        active_slots += run;
+        written += run;
+    }
+
+    return 0;
+}
+
+int flash_log_flush(void)
+{
+    int err = 0;
+
+    if (fa == NULL) {
+        return -ENOENT;
+    }
+
+    k_mutex_lock(&flash_log_lock, K_FOREVER);
+
+    if (pending_count > 0) {
+        err = flash_log_write_pending();
+        if (err) {
+            LOG_ERR("Failed to write %u records (Error %d)", pending_count, err);
+        }
+
+        // Retrying would only keep the queue full, the records are lost either way
+        pending_count = 0;
+    }
+
+    k_mutex_unlock(&flash_log_lock);
+
+    return err;
+}
+
+int flash_log_append(const struct measurement *measurement)
+{
+    struct flash_log_record *record;
+
+    if (fa == NULL) {
+        return -ENOENT;
+    }
+
+    k_mutex_lock(&flash_log_lock, K_FOREVER);
+
+    record = &pending[pending_count++];
+    record->timestamp = k_uptime_get() / MSEC_PER_SEC;
+    record->boot = boot;
+    record->temperature = measurement->temperature;
+    record->humidity = measurement->humidity;
+    record->battery = measurement->battery;
+    record->crc = flash_log_crc(record);
+
+    // Written once the batch is full, or once the oldest record has waited long enough
+    bool full = pending_count == CONFIG_APP_FLASH_LOG_BATCH ||
+                record->timestamp - pending[0].timestamp >= CONFIG_APP_FLASH_LOG_FLUSH_TIME;
+
+    k_mutex_unlock(&flash_log_lock);
+
+    return full ? flash_log_flush() : 0;
+}
+
+u16_t flash_log_boot(void)
+{
+    return boot;
+}
+
+u16_t flash_log_slots(void)
+{
+    return FLASH_LOG_SLOTS;
+}
+
+void flash_log_iter_init(struct flash_log_iter *iter)
+{
+    k_mutex_lock(&flash_log_lock, K_FOREVER);
+    iter->seq = flash_log_oldest_seq(0);
+    iter->slot = 0;
+    k_mutex_unlock(&flash_log_lock);
+}
+
+void flash_log_iter_seek(struct flash_log_iter *iter, u32_t index)
+{
+    k_mutex_lock(&flash_log_lock, K_FOREVER);
+
+    iter->seq = index / FLASH_LOG_SLOTS;
+    iter->slot = index - (iter->seq * FLASH_LOG_SLOTS);
+
+    u32_t oldest = flash_log_oldest_seq(0);
+    if (iter->seq < oldest) {
+        iter->seq = oldest;
+        iter->slot = 0;
+    }
+
+    k_mutex_unlock(&flash_log_lock);
+}
+
+int flash_log_iter_next(struct flash_log_iter *iter, struct flash_log_record *record)
+{
+    int ret = 0;
+
+    if (fa == NULL) {
+        return -ENOENT;
+    }
+
+    k_mutex_lock(&flash_log_lock, K_FOREVER);
+
+    while (ret == 0) {
+        u32_t active_seq = sector_seq[active];
+
+        if (iter->slot == FLASH_LOG_SLOTS) {
+            iter->seq++;
+            iter->slot = 0;
+        }
+
+        if (iter->seq > active_seq || (iter->seq == active_seq && iter->slot >= active_slots)) {
+            // Past the end of flash, hand out what's still queued as if it had been written
+            u32_t index = ((iter->seq - active_seq) * FLASH_LOG_SLOTS) + iter->slot - active_slots;
+
+            if (index < pending_count) {
+                *record = pending[index];
+                iter->slot++;
+                ret = 1;
+            }
+            break;
+        }
+
+        int sector = flash_log_sector(iter->seq);
+        if (sector < 0) {
+            // Recycled while iterating, or a sector lost to an interrupted erase
+            iter->seq = flash_log_oldest_seq(iter->seq);
+            iter->slot = 0;
+            continue;
+        }
+
+        // Records left corrupt by an interrupted write are skipped
+        ret = flash_log_read(sector, iter->slot++, record);
+        if (ret == 0 && record->crc == flash_log_crc(record)) {
+            ret = 1;
+        }
+    }
+
+    k_mutex_unlock(&flash_log_lock);
+
+    return ret;
+}
+
+// Find the end of the newest sector and the boot counter of its last record
+static int flash_log_recover(void)
+{
+    struct flash_log_record record;
+    u16_t lo = 0, hi = FLASH_LOG_SLOTS;
+    int err;
+
+    while (lo < hi) {
+        u16_t mid = (lo + hi) >> 1;
+
+        err = flash_log_read(active, mid, &record);
+        if (err) {
+            return err;
+        }
+
+        if (flash_log_erased(&record)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    active_slots = lo;
+
+    // The newest valid record may be at the end of the previous sector
+    int sector = active;
+    u16_t slot = active_slots;
+
+    while (true) {
+        if (slot == 0) {
+            if (sector_seq[sector] == 0) {
+                break;
+            }
+            sector = flash_log_sector(sector_seq[sector] - 1);
+            if (sector < 0) {
+                break;
+            }
+            slot = FLASH_LOG_SLOTS;
+        }
+
+        err = flash_log_read(sector, --slot, &record);
+        if (err) {
+            return err;
+        }
+
+        if (record.crc == flash_log_crc(&record)) {
+            boot = record.boot + 1;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int flash_log_init(struct device *dev)
+{
+    struct flash_log_sector_header header;
+    u32_t newest = FLASH_LOG_SEQ_INVALID;
+    int err;
+
+    ARG_UNUSED(dev);
+
+    err = flash_area_open(DT_FLASH_AREA_LOG_ID, &fa);
+    if (err) {
+        LOG_ERR("Failed to open the log partition (Error %d)", err);
+        fa = NULL;
+        return 0;
+    }
+
+    sector_count = MIN(fa->fa_size / CONFIG_APP_FLASH_LOG_SECTOR_SIZE, FLASH_LOG_MAX_SECTORS);
+
+    for (u8_t i = 0; i < sector_count; i++) {
+        sector_seq[i] = FLASH_LOG_SEQ_INVALID;
+
+        err = flash_area_read(fa, i * CONFIG_APP_FLASH_LOG_SECTOR_SIZE, &header, sizeof(header));
+        if (err == 0 && header.magic == FLASH_LOG_MAGIC && header.seq != FLASH_LOG_SEQ_INVALID) {
+            sector_seq[i] = header.seq;
+
+            if (newest == FLASH_LOG_SEQ_INVALID || header.seq > newest) {
+                newest = header.seq;
+                active = i;
+            }
+        }
+    }
+
+    if (newest == FLASH_LOG_SEQ_INVALID) {
+        LOG_INF("No log found, starting a new one");
+        err = flash_log_start_sector(0, 0);
+    } else {
+        err = flash_log_recover();
+    }
+
+    if (err) {
+        LOG_ERR("Failed to set up the log (Error %d)", err);
+        fa = NULL;
+        return 0;
+    }
+
+    LOG_INF("Log at sector %u slot %u, boot %u", active, active_slots, boot);
+
+    return 0;
+}
+
+SYS_INIT(flash_log_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
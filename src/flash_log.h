@@ -0,0 +1,70 @@
+#pragma once
+
+#include <zephyr/types.h>
+
+#include "measurement.h"
+
+// One logged measurement as stored in flash, three flash words
+struct flash_log_record {
+    // Seconds since boot
+    u32_t timestamp;
+    // Boot the measurement was taken in, counts up on every start
+    u16_t boot;
+    s16_t temperature;
+    u16_t humidity;
+    u8_t battery;
+    // CRC-8 (CCITT) over the fields above
+    u8_t crc;
+} __packed;
+
+/**
+ * Walks the log from the oldest record onwards, reading each record
+ * straight from flash. Records still waiting to be written are returned
+ * last. Sectors recycled while iterating are skipped.
+ */
+struct flash_log_iter {
+    // Sequence number of the sector being read and the record slot within it
+    u32_t seq;
+    u16_t slot;
+};
+
+/**
+ * Queue a measurement for the log. Records are written in batches of
+ * CONFIG_APP_FLASH_LOG_BATCH, or sooner once the oldest has waited
+ * CONFIG_APP_FLASH_LOG_FLUSH_TIME seconds, so the last few can be lost on
+ * power loss.
+ */
+int flash_log_append(const struct measurement *measurement);
+
+/** Write all queued records to flash now. */
+int flash_log_flush(void);
+
+/** Boot counter stamped on records logged since this boot. */
+u16_t flash_log_boot(void);
+
+/** Number of records that fit in a flash sector. */
+u16_t flash_log_slots(void);
+
+/** Start iterating at the oldest record. */
+void flash_log_iter_init(struct flash_log_iter *iter);
+
+/**
+ * Start iterating at the record with the given index, or the oldest
+ * record if it has been recycled since. Record indices only ever count
+ * up, so they stay valid across reboots.
+ */
+void flash_log_iter_seek(struct flash_log_iter *iter, u32_t index);
+
+/** Index of the record the next flash_log_iter_next() call looks at first. */
+static inline u32_t flash_log_iter_index(const struct flash_log_iter *iter)
+{
+    return (iter->seq * flash_log_slots()) + iter->slot;
+}
+
+/**
+ * Read the next valid record.
+ *
+ * @return 1 if @p record was filled in, 0 at the end of the log, or a
+ * negative error code.
+ */
+int flash_log_iter_next(struct flash_log_iter *iter, struct flash_log_record *record);
@@ -0,0 +1,294 @@
+#include <zephyr.h>
+#include <stdlib.h>
+#include <shell/shell.h>
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(history, LOG_LEVEL_INF);
+
+#include "history.h"
+
+// Samples are stored as a ring of variable length records, each holding the difference to the
+// sample before it. The oldest sample is kept decoded outside the ring, so evicting it only means
+// applying the next record to it, and appending or stepping an iterator are both O(1).
+//
+// A record starts with a header byte flagging which fields follow. Each field is a zigzag varint:
+// - the change in sampling interval since the previous record (usually none),
+// - the temperature, humidity and battery deltas, only when they changed.
+// A stable reading at a steady interval therefore takes a single byte.
+
+#define HISTORY_FIELD_INTERVAL      BIT(0)
+#define HISTORY_FIELD_TEMPERATURE   BIT(1)
+#define HISTORY_FIELD_HUMIDITY      BIT(2)
+#define HISTORY_FIELD_BATTERY       BIT(3)
+
+// Header plus four fields of at most 5 bytes each
+#define HISTORY_RECORD_MAX (1 + (4 * 5))
+
+static u8_t ring[CONFIG_APP_HISTORY_SIZE];
+// Oldest record, where the next record is written, and the bytes in between
+static u16_t tail, head, used;
+
+static u32_t count;
+static u32_t appended;
+
+// Oldest and newest sample held
+static struct history_state oldest, newest;
+
+static K_MUTEX_DEFINE(history_lock);
+
+static inline u32_t zigzag_encode(s32_t value)
+{
+    return ((u32_t)value << 1) ^ (u32_t)(value >> 31);
+}
+
+static inline s32_t zigzag_decode(u32_t value)
+{
+    return (s32_t)(value >> 1) ^ -(s32_t)(value & 1);
+}
+
+static u8_t *varint_put(u8_t *buf, s32_t value)
+{
+    u32_t v = zigzag_encode(value);
+
+    while (v >= 0x80) {
+        *buf++ = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    *buf++ = v;
+
+    return buf;
+}
+
+static inline u8_t ring_get(u16_t *pos)
+{
+    u8_t b = ring[*pos];
+
+    if (++*pos == CONFIG_APP_HISTORY_SIZE) {
+        *pos = 0;
+    }
+
+    return b;
+}
+
+static s32_t varint_get(u16_t *pos)
+{
+    u32_t v = 0;
+    u8_t shift = 0;
+    u8_t b;
+
+    do {
+        b = ring_get(pos);
+        v |= (u32_t)(b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+
+    return zigzag_decode(v);
+}
+
+// Apply the record at pos to state, returns the size of the record
+static u16_t history_decode(u16_t *pos, struct history_state *state)
+{
+    u16_t start = *pos;
+    u8_t fields = ring_get(pos);
+
+    if (fields & HISTORY_FIELD_INTERVAL) {
+        state->interval += varint_get(pos);
+    }
+    state->sample.timestamp += state->interval;
+
+    if (fields & HISTORY_FIELD_TEMPERATURE) {
+        state->sample.temperature += varint_get(pos);
+    }
+    if (fields & HISTORY_FIELD_HUMIDITY) {
+        state->sample.humidity += varint_get(pos);
+    }
+    if (fields & HISTORY_FIELD_BATTERY) {
+        state->sample.battery += varint_get(pos);
+    }
+
+    return (*pos >= start) ? (*pos - start) : (*pos + CONFIG_APP_HISTORY_SIZE - start);
+}
+
+static u16_t history_encode(u8_t *buf, const struct history_state *prev, const struct history_state *next)
+{
+    u8_t *p = buf + 1;
+
+    buf[0] = 0;
+
+    if (next->interval != prev->interval) {
+        buf[0] |= HISTORY_FIELD_INTERVAL;
+        p = varint_put(p, next->interval - prev->interval);
+    }
+    if (next->sample.temperature != prev->sample.temperature) {
+        buf[0] |= HISTORY_FIELD_TEMPERATURE;
+        p = varint_put(p, next->sample.temperature - prev->sample.temperature);
+    }
+    if (next->sample.humidity != prev->sample.humidity) {
+        buf[0] |= HISTORY_FIELD_HUMIDITY;
+        p = varint_put(p, next->sample.humidity - prev->sample.humidity);
+    }
+    if (next->sample.battery != prev->sample.battery) {
+        buf[0] |= HISTORY_FIELD_BATTERY;
+        p = varint_put(p, next->sample.battery - prev->sample.battery);
+    }
+
+    return p - buf;
+}
+
+static void history_evict(void)
+{
+    used -= history_decode(&tail, &oldest);
+    count--;
+}
+
+bool history_append(const struct measurement *measurement)
+{
+    u32_t now = k_uptime_get() / MSEC_PER_SEC;
+    struct history_state next = {
+        .sample = {
+            .timestamp = now,
+            .temperature = measurement->temperature,
+            .humidity = measurement->humidity,
+            .battery = measurement->battery,
+        },
+    };
+    u8_t record[HISTORY_RECORD_MAX];
+
+    k_mutex_lock(&history_lock, K_FOREVER);
+
+    if (count == 0) {
+        oldest = next;
+        newest = next;
+        count = 1;
+        appended++;
+        k_mutex_unlock(&history_lock);
+        return true;
+    }
+
+    next.interval = now - newest.sample.timestamp;
+    if (next.interval < CONFIG_APP_HISTORY_INTERVAL) {
+        k_mutex_unlock(&history_lock);
+        return false;
+    }
+
+    u16_t len = history_encode(record, &newest, &next);
+
+    while (CONFIG_APP_HISTORY_SIZE - used < len) {
+        history_evict();
+    }
+
+    for (u16_t i = 0; i < len; i++) {
+        ring[head] = record[i];
+        if (++head == CONFIG_APP_HISTORY_SIZE) {
+            head = 0;
+        }
+    }
+
+    used += len;
+    count++;
+    appended++;
+    newest = next;
+
+    LOG_DBG("Sample %u stored in %u bytes", appended - 1, len);
+
+    k_mutex_unlock(&history_lock);
+
+    return true;
+}
+
+u32_t history_count(void)
+{
+    return count;
+}
+
+u32_t history_first_index(void)
+{
+    return appended - count;
+}
+
+u32_t history_bytes_used(void)
+{
+    return used;
+}
+
+void history_iter_init(struct history_iter *iter)
+{
+    // Anything before the oldest sample restarts the iteration there
+    iter->next = 0;
+}
+
+bool history_iter_next(struct history_iter *iter, struct history_sample *sample)
+{
+    bool found = true;
+
+    k_mutex_lock(&history_lock, K_FOREVER);
+
+    u32_t first = appended - count;
+
+    if (iter->next < first) {
+        // Everything up to here was evicted, carry on at the oldest sample still held
+        iter->next = first;
+    }
+
+    if (iter->next >= appended) {
+        found = false;
+    } else if (iter->next == first) {
+        iter->state = oldest;
+        iter->pos = tail;
+    } else {
+        history_decode(&iter->pos, &iter->state);
+    }
+
+    if (found) {
+        *sample = iter->state.sample;
+        iter->next++;
+    }
+
+    k_mutex_unlock(&history_lock);
+
+    return found;
+}
+
+static int cmd_history_stats(const struct shell *shell, size_t argc, char **argv)
+{
+    k_mutex_lock(&history_lock, K_FOREVER);
+
+    u32_t samples = count;
+    u32_t bytes = used;
+
+    k_mutex_unlock(&history_lock);
+
+    shell_print(shell, "%u samples in %u of %u bytes", samples, bytes, CONFIG_APP_HISTORY_SIZE);
+
+    // The oldest sample lives outside of the ring, so per sample is over the ones after it
+    if (samples > 1) {
+        u32_t centi = (bytes * 100U) / (samples - 1);
+
+        shell_print(shell, "%u.%02u bytes per sample", centi / 100, centi % 100);
+    }
+
+    return 0;
+}
+
+static int cmd_history_dump(const struct shell *shell, size_t argc, char **argv)
+{
+    struct history_iter iter;
+    struct history_sample sample;
+
+    history_iter_init(&iter);
+
+    while (history_iter_next(&iter, &sample)) {
+        shell_print(shell, "%u: %us %d %u %u%%", iter.next - 1, sample.timestamp,
+                    sample.temperature, sample.humidity, sample.battery);
+    }
+
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_history,
+    SHELL_CMD(stats, NULL, "Samples held and compressed size per sample", cmd_history_stats),
+    SHELL_CMD(dump, NULL, "Print every sample (timestamp, 0.01 degC, 0.01 %RH, battery)", cmd_history_dump),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(history, &sub_history, "Measurement history", NULL);
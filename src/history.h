@@ -0,0 +1,60 @@
+#pragma once
+
+#include <zephyr/types.h>
+
+#include "measurement.h"
+
+struct history_sample {
+    // Seconds since boot
+    u32_t timestamp;
+    s16_t temperature;
+    u16_t humidity;
+    u8_t battery;
+};
+
+// Sample together with the interval that led up to it, as needed to decode the following record
+struct history_state {
+    struct history_sample sample;
+    s32_t interval;
+};
+
+/**
+ * Iterates over the history from the oldest sample onwards. Samples that
+ * are evicted while iterating are skipped.
+ */
+struct history_iter {
+    // Index of the next sample to return
+    u32_t next;
+    // Ring position of the record that decodes to the next sample
+    u16_t pos;
+    // Sample preceding the next one
+    struct history_state state;
+};
+
+/**
+ * Record a measurement. Measurements taken less than
+ * CONFIG_APP_HISTORY_INTERVAL seconds after the last recorded one are
+ * ignored. The oldest samples are evicted when the buffer is full.
+ *
+ * @return true if the measurement was recorded.
+ */
+bool history_append(const struct measurement *measurement);
+
+/** Number of samples held. */
+u32_t history_count(void);
+
+/** Index of the oldest sample held, indices keep counting up across evictions. */
+u32_t history_first_index(void);
+
+/** Bytes of the ring buffer used by the encoded samples. */
+u32_t history_bytes_used(void);
+
+/** Start iterating at the oldest sample. */
+void history_iter_init(struct history_iter *iter);
+
+/**
+ * Get the next sample.
+ *
+ * @return true if @p sample was filled in, false at the end of the history.
+ */
+bool history_iter_next(struct history_iter *iter, struct history_sample *sample);
@@ -5,9 +5,9 @@
 #include <zephyr.h>
 #include <device.h>
 #include <drivers/gpio.h>
-#include <drivers/sensor.h>
 #include <sys/printk.h>
 #include <bluetooth/bluetooth.h>
+#include <settings/settings.h>
 
 #include <logging/log.h>
 LOG_MODULE_REGISTER(main, LOG_LEVEL_DBG);
@@ -16,23 +16,81 @@ LOG_MODULE_REGISTER(main, LOG_LEVEL_DBG);
 #include "display.h"
 #include "sensor.h"
 #include "bluetooth.h"
+#include "advertising.h"
+#include "sampling.h"
+#include "filter.h"
+#include "history.h"
+#include "flash_log.h"
+#include "mesh.h"
+#include "mesh_sensor.h"
 
 static struct gpio_callback button_cb_data;
 
+// Wakes the main loop early when the button is pressed
+static K_SEM_DEFINE(wake_sem, 0, 1);
+
 struct device *dev_button = NULL;
 
 static bool allow_bonding = false;
 
+// Set once Bluetooth is up, possibly from the start thread
+static atomic_t bluetooth_enabled;
+
+static void bluetooth_start(void)
+{
+    s64_t started = k_uptime_get();
+    int ret;
+
+    ret = bt_enable(NULL);
+	if (ret != 0) {
+		LOG_ERR("Bluetooth init failed (Error %d)", ret);
+	}
+
+#if CONFIG_APP_MESH
+    if (ret == 0) {
+        ret = mesh_init();
+    }
+#endif
+
+    // Restore the bonds, CCC states and ESS triggers saved by earlier boots, advertising
+    // depends on the bonds, as does a mesh node on its provisioning data
+    int err = settings_subsys_init();
+    if (err == 0) {
+        err = settings_load();
+    }
+    if (err != 0) {
+        LOG_ERR("Failed to load settings (Error %d)", err);
+    }
+
+    if (ret == 0) {
+        bluetooth_ready();
+        atomic_set(&bluetooth_enabled, 1);
+    }
+
+    s64_t now = k_uptime_get();
+
+    LOG_INF("Advertising %u ms after boot, Bluetooth start took %u ms", (u32_t)now, (u32_t)(now - started));
+}
+
+#if CONFIG_APP_BT_DEFERRED_ENABLE
+// Brings Bluetooth up behind the first reading, the P-256 key generation started by bt_enable()
+// would otherwise keep the display blank on the nRF51
+K_THREAD_DEFINE(bluetooth_start_thread, CONFIG_APP_BT_START_STACK_SIZE, bluetooth_start, NULL, NULL, NULL,
+                K_LOWEST_APPLICATION_THREAD_PRIO, 0, K_FOREVER);
+#endif
+
 void button_pressed(struct device *dev, struct gpio_callback *cb, u32_t pins)
 {
     LOG_INF("Button pressed at %" PRIu32, k_cycle_get_32());
     allow_bonding = true;
+    display_wake();
+    advertising_wake();
+    k_sem_give(&wake_sem);
 }
 
 void main(void)
 {
     int ret;
-    bool bluetooth_enabled = false;
     u32_t loop_count = 0;
 
     LOG_INF("Hello world!");
@@ -58,66 +116,131 @@ void main(void)
     gpio_init_callback(&button_cb_data, button_pressed, BIT(DT_ALIAS_SW0_GPIOS_PIN));
     gpio_add_callback(dev_button, &button_cb_data);
 
-
-    ret = bt_enable(NULL);
-	if (ret != 0) {
-		LOG_ERR("Bluetooth init failed (Error %d)", ret);
-	} else {
-        bluetooth_ready();
-        bluetooth_enabled = true;
-    }
+#if !CONFIG_APP_BT_DEFERRED_ENABLE
+    bluetooth_start();
+#endif
 
     LOG_INF("Press %s on the board", DT_ALIAS_SW0_LABEL);
 
-    struct sensor_value temp, hum;
+    struct measurement raw = { 0 }, measurement = { 0 };
 
     display_set_symbols(DISPLAY_SYMBOL_HORIZONTAL_RULE);
 
     while(1)
     {
-        if (bluetooth_enabled){
+        bool bluetooth_symbol = false;
+        bool bluetooth_blink_off = false;
+        bool battery_valid = false;
+        bool measurement_valid = false;
+        // Until then the start thread may still be loading settings into the services, so
+        // nothing below touches them
+        bool bluetooth_up = atomic_get(&bluetooth_enabled);
+
+        if (bluetooth_up){
             if(allow_bonding){
                 bluetooth_set_bonding(true);
                 allow_bonding = false;
+                // Sample (and blink the bluetooth symbol) quickly while bonding is allowed
+                sampling_boost();
             }
 
-            if (bluetooth_get_bonding() && (loop_count % 2 == 0)) {
-                display_clear_symbols(DISPLAY_SYMBOL_BLUETOOTH);
-            }else {
-                display_set_symbols(DISPLAY_SYMBOL_BLUETOOTH);
-            }
-
+            bluetooth_symbol = true;
+            bluetooth_blink_off = bluetooth_get_bonding() && (loop_count % 2 == 0);
         }
+        // Let the sensor convert while the battery is measured
+        sensor_measure_start();
+
         int batt_mV = battery_sample();
 
 		if (batt_mV >= 0)
         {
-            int batt_pptt = battery_level_pptt(batt_mV, alkaline_level_point) / 100;
-            LOG_INF("Battery: %d%% (%d.%03dV)", batt_pptt, batt_mV / 1000, batt_mV % 1000);
+            int batt_pptt = measurement_div100(battery_level_pptt(batt_mV, alkaline_level_point));
+            LOG_INF("Battery: %d%% (%d mV)", batt_pptt, batt_mV);
 
-            display_set_battery(batt_pptt);
-            bluetooth_update_battery(batt_pptt);
+            measurement.battery = batt_pptt;
+            battery_valid = true;
         }
         else
         {
 			LOG_ERR("Failed to read battery voltage: %d", batt_mV);
         }
 
-        if (update_sensor(&temp, &hum) == 0)
+        if (update_sensor(&raw) == 0)
         {
-            LOG_INF("Sensor: %d.%d°C, %d.%d%%RH",
-                temp.val1, temp.val2 / 100000,
-                hum.val1, hum.val2 / 100000);
+            // Everything below works on the filtered reading, filter_raw() still has the original
+            filter_update(&raw, &measurement);
+            measurement_valid = true;
+
+            u32_t temp_whole, temp_frac, hum_whole, hum_frac;
+            bool temp_negative = measurement.temperature < 0;
+
+            measurement_split(temp_negative ? -measurement.temperature : measurement.temperature,
+                              &temp_whole, &temp_frac);
+            measurement_split(measurement.humidity, &hum_whole, &hum_frac);
+            LOG_INF("Sensor: %s%u.%02u°C, %u.%02u%%RH", temp_negative ? "-" : "",
+                temp_whole, temp_frac, hum_whole, hum_frac);
+        }
 
+        // Collect all display updates of this pass into a single flush. The frame holds the
+        // display lock, which the display's wake and sleep work needs, so nothing else goes in it.
+        display_begin_frame();
+
+        if (bluetooth_symbol) {
+            if (bluetooth_blink_off) {
+                display_clear_symbols(DISPLAY_SYMBOL_BLUETOOTH);
+            }else {
+                display_set_symbols(DISPLAY_SYMBOL_BLUETOOTH);
+            }
+        }
+        if (battery_valid) {
+            display_set_battery(measurement.battery);
+        }
+        if (measurement_valid) {
             display_set_symbols(DISPLAY_SYMBOL_CELSIUS | DISPLAY_SYMBOL_HUMIDITY);
-            display_set_temperature(&temp);
-            display_set_humidity(&hum);
+            display_set_temperature(&measurement);
+            display_set_humidity(&measurement);
+        }
+
+        display_commit_frame();
+
+        if (battery_valid && bluetooth_up) {
+            bluetooth_update_battery(measurement.battery);
+        }
+
+        if (measurement_valid)
+        {
+            if (bluetooth_up) {
+                bluetooth_update_temperature(measurement.temperature);
+                bluetooth_update_humidity(measurement.humidity);
+                bluetooth_update_snapshot(&measurement);
+                advertising_update_broadcast(&measurement);
+#if CONFIG_APP_MESH
+                mesh_sensor_update(&measurement);
+#endif
+            }
+
+            // The flash log keeps the same samples as the history, across power loss
+            if (history_append(&measurement)) {
+                flash_log_append(&measurement);
+            }
+
+            u32_t period = sampling_update(measurement.temperature, measurement.humidity);
+            if (bluetooth_up) {
+                bluetooth_set_update_interval(period);
+            }
+        }
+
+#if CONFIG_APP_MESH
+        mesh_poll();
+#endif
 
-            bluetooth_update_temperature((temp.val1 * 100) + (temp.val2 / 10000));
-            bluetooth_update_humidity((hum.val1 * 100) + (hum.val2 / 10000));
+#if CONFIG_APP_BT_DEFERRED_ENABLE
+        if (loop_count == 0) {
+            k_thread_start(bluetooth_start_thread);
         }
+#endif
 
-        k_sleep(1000);
+        k_sem_take(&wake_sem, K_SECONDS(bluetooth_get_bonding() ? CONFIG_APP_SAMPLING_PERIOD_MIN : sampling_period()));
         loop_count++;
     }
 }
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <zephyr/types.h>
+
+// Readings are kept in hundredths of a unit from the moment they are converted, which is also the
+// resolution ESS uses. The nRF51's Cortex-M0 has no hardware divider, so the helpers below replace
+// the divisions needed to split these values into digits.
+
+struct measurement {
+    // Hundredths of a degree Celsius
+    s16_t temperature;
+    // Hundredths of a percent relative humidity
+    u16_t humidity;
+    // Remaining battery capacity in percent
+    u8_t battery;
+};
+
+/** x / 10 for 0 <= x < 81920, without a division. */
+static inline u32_t measurement_div10(u32_t x)
+{
+    // 0xCCCD / 2^19 is 1/10 rounded up, exact over the whole range above
+    return (x * 0xCCCDU) >> 19;
+}
+
+/** x / 100 for 0 <= x < 81920, without a division. */
+static inline u32_t measurement_div100(u32_t x)
+{
+    return measurement_div10(measurement_div10(x));
+}
+
+/**
+ * Split a value in hundredths into its whole part and hundredths, e.g.
+ * for logging. Only valid for 0 <= centi < 81920.
+ */
+static inline void measurement_split(u32_t centi, u32_t *whole, u32_t *fraction)
+{
+    *whole = measurement_div100(centi);
+    *fraction = centi - (*whole * 100U);
+}
+
+/**
+ * Extract the tens, units and tenths digits of a value in hundredths,
+ * truncating the hundredths. Only valid for 0 <= centi < 10000.
+ */
+static inline void measurement_digits(u32_t centi, u8_t digits[3])
+{
+    u32_t tenths = measurement_div10(centi);
+    u32_t units = measurement_div10(tenths);
+    u32_t tens = measurement_div10(units);
+
+    digits[0] = tens;
+    digits[1] = units - (tens * 10U);
+    digits[2] = tenths - (units * 10U);
+}
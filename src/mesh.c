@@ -0,0 +1,232 @@
+#include <zephyr.h>
+#include <string.h>
+#include <drivers/hwinfo.h>
+#include <shell/shell.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/mesh.h>
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(mesh, LOG_LEVEL_INF);
+
+#include "mesh.h"
+#include "mesh_sensor.h"
+
+#if CONFIG_APP_MESH
+
+// Linux Foundation, as used by Zephyr's samples
+#define MESH_COMPANY_ID 0x05f1
+
+#if CONFIG_BT_MESH_LOW_POWER
+
+// A Low Power Node scans only for its Friend's answers to a poll, instead of all the time. The
+// Friend is asked for once provisioning and configuration have gone quiet (LPN_AUTO), preferring
+// offers with a short receive window. With no Friend around the search is retried every
+// LPN_RETRY_TIMEOUT seconds, see mesh.conf.
+//
+// Polls are sent from mesh_poll() on sampling wakeups. As long as a wakeup comes before the
+// stack's own poll timer runs out the device never wakes up just to poll.
+BUILD_ASSERT((CONFIG_APP_MESH_LPN_POLL_MIN + CONFIG_APP_SAMPLING_PERIOD_MAX) * 10 < CONFIG_BT_MESH_LPN_POLL_TIMEOUT);
+
+// Radio time of an advertising event carrying a network PDU: three channels, each with a 47 byte
+// PDU at 1 Mbit/s and the nRF51's 140 us ramp up
+#define MESH_ADV_EVENT_US (3 * (47 * 8 + 140))
+
+// Scanning stops as soon as the Friend's answer comes in, typically a few ms into the receive
+// window
+#define MESH_POLL_SCAN_US ((CONFIG_BT_MESH_LPN_SCAN_LATENCY + 10) * 1000)
+
+static bool friend_established;
+static u16_t friend_addr;
+static u32_t friend_since;
+static u32_t friendships, friendships_lost;
+
+static u32_t last_poll;
+static u32_t poll_count;
+
+#endif // CONFIG_BT_MESH_LOW_POWER
+
+static struct bt_mesh_cfg_srv cfg_srv = {
+#if CONFIG_BT_MESH_LOW_POWER
+    // Messages for the node come through the Friend, which also relays the beacons
+    .relay = BT_MESH_RELAY_NOT_SUPPORTED,
+    .beacon = BT_MESH_BEACON_DISABLED,
+#else
+    .relay = BT_MESH_RELAY_DISABLED,
+    .beacon = BT_MESH_BEACON_ENABLED,
+#endif
+    .frnd = BT_MESH_FRIEND_NOT_SUPPORTED,
+    .gatt_proxy = BT_MESH_GATT_PROXY_NOT_SUPPORTED,
+    .default_ttl = 7,
+    .net_transmit = BT_MESH_TRANSMIT(2, 20),
+    .relay_retransmit = BT_MESH_TRANSMIT(2, 20),
+};
+
+static void attention_on(struct bt_mesh_model *model)
+{
+    LOG_INF("Attention on");
+}
+
+static void attention_off(struct bt_mesh_model *model)
+{
+    LOG_INF("Attention off");
+}
+
+static const struct bt_mesh_health_srv_cb health_cb = {
+    .attn_on = attention_on,
+    .attn_off = attention_off,
+};
+
+static struct bt_mesh_health_srv health_srv = {
+    .cb = &health_cb,
+};
+
+BT_MESH_HEALTH_PUB_DEFINE(health_pub, 0);
+
+static struct bt_mesh_model root_models[] = {
+    BT_MESH_MODEL_CFG_SRV(&cfg_srv),
+    BT_MESH_MODEL_HEALTH_SRV(&health_srv, &health_pub),
+    MESH_SENSOR_MODELS,
+};
+
+static struct bt_mesh_elem elements[] = {
+    BT_MESH_ELEM(0, root_models, BT_MESH_MODEL_NONE),
+};
+
+static const struct bt_mesh_comp comp = {
+    .cid = MESH_COMPANY_ID,
+    .elem = elements,
+    .elem_count = ARRAY_SIZE(elements),
+};
+
+// Filled with the chip's device ID, so it stays the same across reflashing
+static u8_t dev_uuid[16];
+
+static void prov_complete(u16_t net_idx, u16_t addr)
+{
+    LOG_INF("Provisioned as 0x%04x on net %u", addr, net_idx);
+}
+
+static void prov_reset(void)
+{
+    LOG_INF("Node reset");
+    bt_mesh_prov_enable(BT_MESH_PROV_ADV);
+}
+
+static const struct bt_mesh_prov prov = {
+    .uuid = dev_uuid,
+    .complete = prov_complete,
+    .reset = prov_reset,
+};
+
+#if CONFIG_BT_MESH_LOW_POWER
+
+static void lpn_changed(u16_t addr, bool established)
+{
+    friend_established = established;
+
+    if (established) {
+        friend_addr = addr;
+        friend_since = k_uptime_get_32();
+        friendships++;
+        LOG_INF("Friendship with 0x%04x established", addr);
+    } else {
+        friendships_lost++;
+        LOG_WRN("Friendship with 0x%04x lost", addr);
+    }
+}
+
+void mesh_poll(void)
+{
+    u32_t now = k_uptime_get_32();
+
+    if (!friend_established || now - last_poll < K_SECONDS(CONFIG_APP_MESH_LPN_POLL_MIN)) {
+        return;
+    }
+
+    int err = bt_mesh_lpn_poll();
+    if (err) {
+        LOG_DBG("Poll failed (Error %d)", err);
+        return;
+    }
+
+    last_poll = now;
+    poll_count++;
+}
+
+static int cmd_lpn(const struct shell *shell, size_t argc, char **argv)
+{
+    u32_t now = k_uptime_get_32();
+    u32_t publications = mesh_sensor_publication_count();
+
+    if (friend_established) {
+        shell_print(shell, "Friend 0x%04x for %u s", friend_addr, (now - friend_since) / 1000U);
+    } else {
+        shell_print(shell, "No Friend");
+    }
+    shell_print(shell, "%u friendships, %u lost, %u polls, %u publications", friendships, friendships_lost,
+                poll_count, publications);
+
+    // Publications go out net transmit count + 1 times, polls once followed by a short scan. Polls
+    // made by the stack itself and the Friend search aren't counted.
+    u64_t radio_us = (u64_t)publications * (BT_MESH_TRANSMIT_COUNT(cfg_srv.net_transmit) + 1) * MESH_ADV_EVENT_US +
+                     (u64_t)poll_count * (MESH_ADV_EVENT_US + MESH_POLL_SCAN_US);
+
+    if (now >= 1000) {
+        u32_t per_hour = radio_us * 3600U / now;
+
+        shell_print(shell, "Radio on time (estimate from message counts, not measured): %u ms per hour (%u.%03u %%)",
+                    per_hour, per_hour / 36000U, (per_hour % 36000U) / 36U);
+    }
+
+    return 0;
+}
+
+SHELL_CMD_REGISTER(lpn, NULL, "Low Power Node friendship and estimated radio on time", cmd_lpn);
+
+#else
+
+void mesh_poll(void)
+{
+}
+
+#endif // CONFIG_BT_MESH_LOW_POWER
+
+int mesh_init(void)
+{
+    int err;
+
+    if (hwinfo_get_device_id(dev_uuid, sizeof(dev_uuid)) < 0) {
+        LOG_WRN("No device ID, using an all zero UUID");
+    }
+
+    err = bt_mesh_init(&prov, &comp);
+    if (err) {
+        LOG_ERR("Mesh init failed (Error %d)", err);
+        return err;
+    }
+
+#if CONFIG_BT_MESH_LOW_POWER
+    bt_mesh_lpn_set_cb(lpn_changed);
+#endif
+
+    return 0;
+}
+
+void mesh_start(void)
+{
+    if (bt_mesh_is_provisioned()) {
+        LOG_INF("Provisioned node restored");
+        return;
+    }
+
+    int err = bt_mesh_prov_enable(BT_MESH_PROV_ADV);
+    if (err) {
+        LOG_ERR("Failed to enable provisioning (Error %d)", err);
+        return;
+    }
+
+    LOG_INF("Waiting to be provisioned");
+}
+
+#endif // CONFIG_APP_MESH
@@ -0,0 +1,27 @@
+#pragma once
+
+/**
+ * Bluetooth Mesh node, built with -DUSE_MESH=1. It takes the place of the
+ * GATT advertising policy: an unprovisioned node sends unprovisioned
+ * device beacons (PB-ADV) and a provisioned one publishes its readings
+ * through the models in mesh_sensor.h. With BT_MESH_LOW_POWER (as in
+ * mesh.conf) it is a Low Power Node, receiving through a Friend.
+ */
+
+/**
+ * Register the node's composition with the stack. Needs Bluetooth
+ * enabled, and must run before the settings are loaded so they restore
+ * the provisioning data and keys.
+ */
+int mesh_init(void);
+
+/** Start provisioning if the settings didn't hold a provisioned node. */
+void mesh_start(void);
+
+/**
+ * Called on every sampling wakeup. As a Low Power Node, polls the Friend
+ * for queued messages if the last poll is at least
+ * CONFIG_APP_MESH_LPN_POLL_MIN seconds old, so polls ride on wakeups that
+ * happen anyway instead of waking the device on their own.
+ */
+void mesh_poll(void);
@@ -0,0 +1,732 @@
+#include <zephyr.h>
+#include <init.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/byteorder.h>
+#include <shell/shell.h>
+#include <settings/settings.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/mesh.h>
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(mesh_sensor, LOG_LEVEL_INF);
+
+#include "mesh_sensor.h"
+
+#if CONFIG_APP_MESH
+
+// Sensor Server (descriptors and readings) and Sensor Setup Server (cadence and settings), Mesh
+// Model specification section 4. Both properties are 16 bit values, so a Sensor Status carrying
+// both is 1 opcode byte and 2 * (2 byte Format A header + 2 byte value), which fits in a single
+// unsegmented access message. Cadence and descriptor status messages are segmented, but those
+// are only sent when asked for or when the cadence changes.
+//
+// Periodic publication is configured by the provisioner through the Configuration Server as
+// usual. On top of it
+//
+// - a reading that moved by Status Trigger Delta Up/Down since it was last published is
+//   published right away, at most once per Status Min Interval
+// - while a reading is within the Fast Cadence range, the publish period is divided by
+//   2^Fast Cadence Period Divisor, as far as the Status Min Interval allows
+
+#define OP_DESCRIPTOR_GET       BT_MESH_MODEL_OP_2(0x82, 0x30)
+#define OP_DESCRIPTOR_STATUS    BT_MESH_MODEL_OP_1(0x51)
+#define OP_SENSOR_GET           BT_MESH_MODEL_OP_2(0x82, 0x31)
+#define OP_SENSOR_STATUS        BT_MESH_MODEL_OP_1(0x52)
+#define OP_COLUMN_GET           BT_MESH_MODEL_OP_2(0x82, 0x32)
+#define OP_COLUMN_STATUS        BT_MESH_MODEL_OP_1(0x53)
+#define OP_SERIES_GET           BT_MESH_MODEL_OP_2(0x82, 0x33)
+#define OP_SERIES_STATUS        BT_MESH_MODEL_OP_1(0x54)
+#define OP_CADENCE_GET          BT_MESH_MODEL_OP_2(0x82, 0x34)
+#define OP_CADENCE_SET          BT_MESH_MODEL_OP_1(0x55)
+#define OP_CADENCE_SET_UNACK    BT_MESH_MODEL_OP_1(0x56)
+#define OP_CADENCE_STATUS       BT_MESH_MODEL_OP_1(0x57)
+#define OP_SETTINGS_GET         BT_MESH_MODEL_OP_2(0x82, 0x35)
+#define OP_SETTINGS_STATUS      BT_MESH_MODEL_OP_1(0x58)
+#define OP_SETTING_GET          BT_MESH_MODEL_OP_2(0x82, 0x36)
+#define OP_SETTING_SET          BT_MESH_MODEL_OP_1(0x59)
+#define OP_SETTING_SET_UNACK    BT_MESH_MODEL_OP_1(0x5a)
+#define OP_SETTING_STATUS       BT_MESH_MODEL_OP_1(0x5b)
+
+// Precise Present Ambient Temperature (0.01 degC) and Present Ambient Relative Humidity (0.01 %)
+#define PROPERTY_TEMPERATURE    0x0075
+#define PROPERTY_HUMIDITY       0x0076
+
+#define MESH_SENSOR_VALUE_SIZE      2
+#define MESH_SENSOR_DATA_SIZE       (2 + MESH_SENSOR_VALUE_SIZE)
+#define MESH_SENSOR_DESCRIPTOR_SIZE 8
+// Property ID excluded: divisor and trigger type, two deltas, min interval and the fast cadence range
+#define MESH_SENSOR_CADENCE_SIZE    (2 + 4 * MESH_SENSOR_VALUE_SIZE)
+
+#define MESH_SENSOR_STATUS_MAX  (1 + 2 * MESH_SENSOR_DATA_SIZE)
+#define MESH_SENSOR_CADENCE_MAX (1 + 2 + MESH_SENSOR_CADENCE_SIZE)
+
+// Largest access message sent unsegmented, with a 32 bit TransMIC
+#define MESH_UNSEGMENTED_MAX 11
+
+BUILD_ASSERT(MESH_SENSOR_STATUS_MAX <= MESH_UNSEGMENTED_MAX);
+
+#define TRIGGER_VALUE   0
+#define TRIGGER_PERCENT 1
+
+#define FAST_CADENCE_DIVISOR_MAX    15
+#define STATUS_MIN_INTERVAL_MAX     26
+
+// Marks a Format B Marshalled Sensor Data header without a value, for unknown properties
+#define FORMAT_B_NO_VALUE 0xff
+
+struct mesh_sensor_cadence {
+    // Fast Cadence Period Divisor (log2) and Status Trigger Type
+    u8_t period_div;
+    u8_t trigger_type;
+    // In units of the value, or of 0.01 % of it with TRIGGER_PERCENT
+    u16_t delta_down;
+    u16_t delta_up;
+    // log2 of the interval in ms
+    u8_t min_interval;
+    s32_t fast_low;
+    s32_t fast_high;
+};
+
+struct mesh_sensor {
+    u16_t property_id;
+    bool is_signed;
+    // Raw value meaning "value is not known"
+    u16_t unknown;
+    const char *settings_name;
+    struct mesh_sensor_cadence cadence;
+    s32_t value;
+    bool valid;
+    // Last value published and when
+    s32_t published;
+    u32_t published_at;
+    bool was_published;
+};
+
+static struct mesh_sensor sensor_temp = {
+    .property_id = PROPERTY_TEMPERATURE,
+    .is_signed = true,
+    .unknown = 0x8000,
+    .settings_name = "temp",
+    .cadence = {
+        .trigger_type = TRIGGER_VALUE,
+        .delta_down = CONFIG_APP_MESH_TEMPERATURE_DELTA,
+        .delta_up = CONFIG_APP_MESH_TEMPERATURE_DELTA,
+        .min_interval = CONFIG_APP_MESH_STATUS_MIN_INTERVAL,
+    },
+};
+
+static struct mesh_sensor sensor_humid = {
+    .property_id = PROPERTY_HUMIDITY,
+    .is_signed = false,
+    .unknown = 0xffff,
+    .settings_name = "humid",
+    .cadence = {
+        .trigger_type = TRIGGER_VALUE,
+        .delta_down = CONFIG_APP_MESH_HUMIDITY_DELTA,
+        .delta_up = CONFIG_APP_MESH_HUMIDITY_DELTA,
+        .min_interval = CONFIG_APP_MESH_STATUS_MIN_INTERVAL,
+    },
+};
+
+static struct mesh_sensor *const mesh_sensors[] = {
+    &sensor_temp,
+    &sensor_humid,
+};
+
+static K_MUTEX_DEFINE(mesh_sensor_lock);
+static struct k_delayed_work publish_work;
+
+// Publications made periodically and by the delta triggers, and triggers held back by the
+// status min interval
+static u32_t periodic_count, triggered_count, deferred_count;
+
+static int mesh_sensor_pub_update(struct bt_mesh_model *model);
+
+NET_BUF_SIMPLE_DEFINE_STATIC(sensor_srv_pub_msg, MESH_SENSOR_STATUS_MAX);
+NET_BUF_SIMPLE_DEFINE_STATIC(sensor_setup_srv_pub_msg, MESH_SENSOR_CADENCE_MAX);
+
+struct bt_mesh_model_pub mesh_sensor_srv_pub = {
+    .update = mesh_sensor_pub_update,
+    .msg = &sensor_srv_pub_msg,
+};
+
+struct bt_mesh_model_pub mesh_sensor_setup_srv_pub = {
+    .msg = &sensor_setup_srv_pub_msg,
+};
+
+static struct mesh_sensor *mesh_sensor_find(u16_t property_id)
+{
+    for (int i = 0; i < ARRAY_SIZE(mesh_sensors); i++) {
+        if (mesh_sensors[i]->property_id == property_id) {
+            return mesh_sensors[i];
+        }
+    }
+
+    return NULL;
+}
+
+static s32_t mesh_sensor_pull_value(struct net_buf_simple *buf, const struct mesh_sensor *sensor)
+{
+    u16_t raw = net_buf_simple_pull_le16(buf);
+
+    return sensor->is_signed ? (s16_t)raw : raw;
+}
+
+// Publish period in ms, from the Publish Period state
+static u32_t mesh_sensor_period_ms(u8_t period)
+{
+    static const u32_t resolution[] = { 100, 1000, 10000, 600000 };
+
+    return (period & 0x3f) * resolution[period >> 6];
+}
+
+static bool mesh_sensor_fast(const struct mesh_sensor *sensor)
+{
+    const struct mesh_sensor_cadence *cadence = &sensor->cadence;
+
+    if (!sensor->valid || cadence->period_div == 0) {
+        return false;
+    }
+
+    if (cadence->fast_high >= cadence->fast_low) {
+        return sensor->value >= cadence->fast_low && sensor->value <= cadence->fast_high;
+    }
+
+    return sensor->value <= cadence->fast_high || sensor->value >= cadence->fast_low;
+}
+
+static bool mesh_sensor_triggered(const struct mesh_sensor *sensor)
+{
+    const struct mesh_sensor_cadence *cadence = &sensor->cadence;
+
+    if (!sensor->valid) {
+        return false;
+    }
+    if (!sensor->was_published) {
+        return true;
+    }
+
+    s32_t change = sensor->value - sensor->published;
+
+    if (cadence->trigger_type == TRIGGER_PERCENT) {
+        s64_t reference = sensor->published < 0 ? -sensor->published : sensor->published;
+
+        if (change > 0) {
+            return (s64_t)change * 10000 >= (s64_t)cadence->delta_up * reference;
+        }
+        if (change < 0) {
+            return (s64_t)-change * 10000 >= (s64_t)cadence->delta_down * reference;
+        }
+        return false;
+    }
+
+    return (change > 0 && change >= cadence->delta_up) || (change < 0 && -change >= cadence->delta_down);
+}
+
+// Use the fast cadence while any reading is within its range, never publishing more often than
+// its status min interval allows
+static void mesh_sensor_apply_cadence(void)
+{
+    struct bt_mesh_model_pub *pub = &mesh_sensor_srv_pub;
+    u32_t period = mesh_sensor_period_ms(pub->period);
+    u8_t div = 0;
+
+    for (int i = 0; i < ARRAY_SIZE(mesh_sensors); i++) {
+        const struct mesh_sensor *sensor = mesh_sensors[i];
+
+        if (!mesh_sensor_fast(sensor)) {
+            continue;
+        }
+
+        u8_t sensor_div = sensor->cadence.period_div;
+
+        while (sensor_div > 0 && (period >> sensor_div) < (1U << sensor->cadence.min_interval)) {
+            sensor_div--;
+        }
+
+        div = MAX(div, sensor_div);
+    }
+
+    pub->period_div = div;
+    pub->fast_period = div > 0;
+}
+
+static void mesh_sensor_encode(struct net_buf_simple *buf, const struct mesh_sensor *sensor)
+{
+    // Format A: 1 bit format (0), 4 bits length - 1 and 11 bits property ID
+    net_buf_simple_add_le16(buf, ((MESH_SENSOR_VALUE_SIZE - 1) << 1) | (sensor->property_id << 5));
+    net_buf_simple_add_le16(buf, sensor->valid ? (u16_t)sensor->value : sensor->unknown);
+}
+
+static void mesh_sensor_encode_descriptor(struct net_buf_simple *buf, const struct mesh_sensor *sensor)
+{
+    net_buf_simple_add_le16(buf, sensor->property_id);
+    // Positive and negative tolerance, unspecified
+    memset(net_buf_simple_add(buf, 3), 0, 3);
+    // Sampling function, instantaneous unless the readings are filtered
+    net_buf_simple_add_u8(buf, IS_ENABLED(CONFIG_APP_FILTER_NONE) ? 0x01 : 0x00);
+    // Measurement period and update interval, not applicable as sampling adapts to the readings
+    net_buf_simple_add_u8(buf, 0);
+    net_buf_simple_add_u8(buf, 0);
+}
+
+static void mesh_sensor_encode_cadence(struct net_buf_simple *buf, const struct mesh_sensor *sensor)
+{
+    const struct mesh_sensor_cadence *cadence = &sensor->cadence;
+
+    net_buf_simple_add_le16(buf, sensor->property_id);
+    net_buf_simple_add_u8(buf, cadence->period_div | (cadence->trigger_type << 7));
+    net_buf_simple_add_le16(buf, cadence->delta_down);
+    net_buf_simple_add_le16(buf, cadence->delta_up);
+    net_buf_simple_add_u8(buf, cadence->min_interval);
+    net_buf_simple_add_le16(buf, (u16_t)cadence->fast_low);
+    net_buf_simple_add_le16(buf, (u16_t)cadence->fast_high);
+}
+
+static void mesh_sensor_mark_published(struct mesh_sensor *sensor, u32_t now)
+{
+    sensor->published = sensor->value;
+    sensor->published_at = now;
+    sensor->was_published = true;
+}
+
+static int mesh_sensor_pub_update(struct bt_mesh_model *model)
+{
+    struct net_buf_simple *msg = model->pub->msg;
+    u32_t now = k_uptime_get_32();
+    int count = 0;
+
+    k_mutex_lock(&mesh_sensor_lock, K_FOREVER);
+
+    bt_mesh_model_msg_init(msg, OP_SENSOR_STATUS);
+
+    for (int i = 0; i < ARRAY_SIZE(mesh_sensors); i++) {
+        struct mesh_sensor *sensor = mesh_sensors[i];
+
+        if (!sensor->valid) {
+            continue;
+        }
+
+        mesh_sensor_encode(msg, sensor);
+        mesh_sensor_mark_published(sensor, now);
+        count++;
+    }
+
+    mesh_sensor_apply_cadence();
+
+    if (count > 0) {
+        periodic_count++;
+    }
+
+    k_mutex_unlock(&mesh_sensor_lock);
+
+    // Nothing to publish before the first reading
+    return count > 0 ? 0 : -ENODATA;
+}
+
+// Publish the readings that moved past their delta triggers
+static void mesh_sensor_publish_handler(struct k_work *work)
+{
+    struct bt_mesh_model_pub *pub = &mesh_sensor_srv_pub;
+    struct net_buf_simple *msg = pub->msg;
+    u32_t now = k_uptime_get_32();
+    u32_t retry = 0;
+    int count = 0;
+
+    if (pub->addr == BT_MESH_ADDR_UNASSIGNED) {
+        return;
+    }
+
+    k_mutex_lock(&mesh_sensor_lock, K_FOREVER);
+
+    mesh_sensor_apply_cadence();
+
+    bt_mesh_model_msg_init(msg, OP_SENSOR_STATUS);
+
+    for (int i = 0; i < ARRAY_SIZE(mesh_sensors); i++) {
+        struct mesh_sensor *sensor = mesh_sensors[i];
+
+        if (!mesh_sensor_triggered(sensor)) {
+            continue;
+        }
+
+        u32_t min_interval = 1U << sensor->cadence.min_interval;
+        u32_t elapsed = now - sensor->published_at;
+
+        if (sensor->was_published && elapsed < min_interval) {
+            // Checked again once allowed, the reading may have settled back by then
+            retry = retry ? MIN(retry, min_interval - elapsed) : min_interval - elapsed;
+            deferred_count++;
+            continue;
+        }
+
+        mesh_sensor_encode(msg, sensor);
+        mesh_sensor_mark_published(sensor, now);
+        count++;
+    }
+
+    if (count > 0) {
+        triggered_count++;
+    }
+
+    k_mutex_unlock(&mesh_sensor_lock);
+
+    if (count > 0) {
+        int err = bt_mesh_model_publish(pub->mod);
+        if (err) {
+            LOG_WRN("Failed to publish (Error %d)", err);
+        }
+    }
+
+    if (retry) {
+        k_delayed_work_submit(&publish_work, K_MSEC(retry));
+    }
+}
+
+void mesh_sensor_update(const struct measurement *measurement)
+{
+    k_mutex_lock(&mesh_sensor_lock, K_FOREVER);
+
+    sensor_temp.value = measurement->temperature;
+    sensor_temp.valid = true;
+    sensor_humid.value = measurement->humidity;
+    sensor_humid.valid = true;
+
+    k_mutex_unlock(&mesh_sensor_lock);
+
+    k_delayed_work_submit(&publish_work, K_NO_WAIT);
+}
+
+u32_t mesh_sensor_publication_count(void)
+{
+    k_mutex_lock(&mesh_sensor_lock, K_FOREVER);
+    u32_t count = periodic_count + triggered_count;
+    k_mutex_unlock(&mesh_sensor_lock);
+
+    return count;
+}
+
+static void mesh_sensor_save(const struct mesh_sensor *sensor)
+{
+#if CONFIG_SETTINGS
+    char name[16];
+    int err;
+
+    snprintk(name, sizeof(name), "msensor/%s", sensor->settings_name);
+
+    err = settings_save_one(name, &sensor->cadence, sizeof(sensor->cadence));
+    if (err) {
+        LOG_ERR("Failed to save %s cadence (Error %d)", sensor->settings_name, err);
+    }
+#endif
+}
+
+static void descriptor_get(struct bt_mesh_model *model, struct bt_mesh_msg_ctx *ctx, struct net_buf_simple *buf)
+{
+    BT_MESH_MODEL_BUF_DEFINE(msg, OP_DESCRIPTOR_STATUS, ARRAY_SIZE(mesh_sensors) * MESH_SENSOR_DESCRIPTOR_SIZE);
+
+    bt_mesh_model_msg_init(&msg, OP_DESCRIPTOR_STATUS);
+
+    if (buf->len == 2) {
+        u16_t property_id = net_buf_simple_pull_le16(buf);
+        const struct mesh_sensor *sensor = mesh_sensor_find(property_id);
+
+        if (sensor) {
+            mesh_sensor_encode_descriptor(&msg, sensor);
+        } else {
+            net_buf_simple_add_le16(&msg, property_id);
+        }
+    } else if (buf->len == 0) {
+        for (int i = 0; i < ARRAY_SIZE(mesh_sensors); i++) {
+            mesh_sensor_encode_descriptor(&msg, mesh_sensors[i]);
+        }
+    } else {
+        return;
+    }
+
+    bt_mesh_model_send(model, ctx, &msg, NULL, NULL);
+}
+
+static void sensor_get(struct bt_mesh_model *model, struct bt_mesh_msg_ctx *ctx, struct net_buf_simple *buf)
+{
+    BT_MESH_MODEL_BUF_DEFINE(msg, OP_SENSOR_STATUS, MESH_SENSOR_STATUS_MAX - 1);
+
+    bt_mesh_model_msg_init(&msg, OP_SENSOR_STATUS);
+
+    k_mutex_lock(&mesh_sensor_lock, K_FOREVER);
+
+    if (buf->len == 2) {
+        u16_t property_id = net_buf_simple_pull_le16(buf);
+        const struct mesh_sensor *sensor = mesh_sensor_find(property_id);
+
+        if (sensor) {
+            mesh_sensor_encode(&msg, sensor);
+        } else {
+            net_buf_simple_add_u8(&msg, FORMAT_B_NO_VALUE);
+            net_buf_simple_add_le16(&msg, property_id);
+        }
+    } else if (buf->len == 0) {
+        for (int i = 0; i < ARRAY_SIZE(mesh_sensors); i++) {
+            mesh_sensor_encode(&msg, mesh_sensors[i]);
+        }
+    } else {
+        k_mutex_unlock(&mesh_sensor_lock);
+        return;
+    }
+
+    k_mutex_unlock(&mesh_sensor_lock);
+
+    bt_mesh_model_send(model, ctx, &msg, NULL, NULL);
+}
+
+// Neither property has columns or a series, the status only echoes the request
+static void column_get(struct bt_mesh_model *model, struct bt_mesh_msg_ctx *ctx, struct net_buf_simple *buf)
+{
+    BT_MESH_MODEL_BUF_DEFINE(msg, OP_COLUMN_STATUS, 2 + MESH_SENSOR_VALUE_SIZE);
+    u16_t property_id = net_buf_simple_pull_le16(buf);
+
+    bt_mesh_model_msg_init(&msg, OP_COLUMN_STATUS);
+    net_buf_simple_add_le16(&msg, property_id);
+
+    if (mesh_sensor_find(property_id) && buf->len == MESH_SENSOR_VALUE_SIZE) {
+        net_buf_simple_add_mem(&msg, buf->data, buf->len);
+    }
+
+    bt_mesh_model_send(model, ctx, &msg, NULL, NULL);
+}
+
+static void series_get(struct bt_mesh_model *model, struct bt_mesh_msg_ctx *ctx, struct net_buf_simple *buf)
+{
+    BT_MESH_MODEL_BUF_DEFINE(msg, OP_SERIES_STATUS, 2);
+
+    bt_mesh_model_msg_init(&msg, OP_SERIES_STATUS);
+    net_buf_simple_add_le16(&msg, net_buf_simple_pull_le16(buf));
+
+    bt_mesh_model_send(model, ctx, &msg, NULL, NULL);
+}
+
+const struct bt_mesh_model_op mesh_sensor_srv_op[] = {
+    { OP_DESCRIPTOR_GET, 0, descriptor_get },
+    { OP_SENSOR_GET, 0, sensor_get },
+    { OP_COLUMN_GET, 2, column_get },
+    { OP_SERIES_GET, 2, series_get },
+    BT_MESH_MODEL_OP_END,
+};
+
+static void cadence_status(struct net_buf_simple *msg, u16_t property_id)
+{
+    const struct mesh_sensor *sensor = mesh_sensor_find(property_id);
+
+    bt_mesh_model_msg_init(msg, OP_CADENCE_STATUS);
+
+    if (sensor) {
+        k_mutex_lock(&mesh_sensor_lock, K_FOREVER);
+        mesh_sensor_encode_cadence(msg, sensor);
+        k_mutex_unlock(&mesh_sensor_lock);
+    } else {
+        net_buf_simple_add_le16(msg, property_id);
+    }
+}
+
+static void cadence_get(struct bt_mesh_model *model, struct bt_mesh_msg_ctx *ctx, struct net_buf_simple *buf)
+{
+    BT_MESH_MODEL_BUF_DEFINE(msg, OP_CADENCE_STATUS, MESH_SENSOR_CADENCE_MAX - 1);
+
+    cadence_status(&msg, net_buf_simple_pull_le16(buf));
+
+    bt_mesh_model_send(model, ctx, &msg, NULL, NULL);
+}
+
+// Returns false if the message is to be ignored
+static bool cadence_update(struct net_buf_simple *buf)
+{
+    u16_t property_id = net_buf_simple_pull_le16(buf);
+    struct mesh_sensor *sensor = mesh_sensor_find(property_id);
+    struct mesh_sensor_cadence cadence;
+
+    if (sensor == NULL) {
+        return true;
+    }
+
+    if (buf->len != MESH_SENSOR_CADENCE_SIZE) {
+        LOG_WRN("Cadence of the wrong size (%u)", buf->len);
+        return false;
+    }
+
+    u8_t div_type = net_buf_simple_pull_u8(buf);
+
+    cadence.period_div = div_type & 0x7f;
+    cadence.trigger_type = div_type >> 7;
+    cadence.delta_down = net_buf_simple_pull_le16(buf);
+    cadence.delta_up = net_buf_simple_pull_le16(buf);
+    cadence.min_interval = net_buf_simple_pull_u8(buf);
+    cadence.fast_low = mesh_sensor_pull_value(buf, sensor);
+    cadence.fast_high = mesh_sensor_pull_value(buf, sensor);
+
+    // Prohibited values, the message is ignored
+    if (cadence.period_div > FAST_CADENCE_DIVISOR_MAX || cadence.min_interval > STATUS_MIN_INTERVAL_MAX) {
+        return false;
+    }
+
+    k_mutex_lock(&mesh_sensor_lock, K_FOREVER);
+    sensor->cadence = cadence;
+    mesh_sensor_apply_cadence();
+    k_mutex_unlock(&mesh_sensor_lock);
+
+    mesh_sensor_save(sensor);
+
+    LOG_INF("%s cadence: divisor %u, deltas -%u/+%u%s, min interval %u ms", sensor->settings_name,
+            1U << cadence.period_div, cadence.delta_down, cadence.delta_up,
+            cadence.trigger_type == TRIGGER_PERCENT ? " (0.01 %)" : "", 1U << cadence.min_interval);
+
+    struct bt_mesh_model_pub *pub = &mesh_sensor_setup_srv_pub;
+
+    if (pub->addr != BT_MESH_ADDR_UNASSIGNED) {
+        cadence_status(pub->msg, property_id);
+        bt_mesh_model_publish(pub->mod);
+    }
+
+    // The new deltas may call for a publication
+    k_delayed_work_submit(&publish_work, K_NO_WAIT);
+
+    return true;
+}
+
+static void cadence_set(struct bt_mesh_model *model, struct bt_mesh_msg_ctx *ctx, struct net_buf_simple *buf)
+{
+    BT_MESH_MODEL_BUF_DEFINE(msg, OP_CADENCE_STATUS, MESH_SENSOR_CADENCE_MAX - 1);
+    u16_t property_id = sys_get_le16(buf->data);
+
+    if (!cadence_update(buf)) {
+        return;
+    }
+
+    cadence_status(&msg, property_id);
+    bt_mesh_model_send(model, ctx, &msg, NULL, NULL);
+}
+
+static void cadence_set_unack(struct bt_mesh_model *model, struct bt_mesh_msg_ctx *ctx, struct net_buf_simple *buf)
+{
+    cadence_update(buf);
+}
+
+// Neither property has any settings
+static void settings_get(struct bt_mesh_model *model, struct bt_mesh_msg_ctx *ctx, struct net_buf_simple *buf)
+{
+    BT_MESH_MODEL_BUF_DEFINE(msg, OP_SETTINGS_STATUS, 2);
+
+    bt_mesh_model_msg_init(&msg, OP_SETTINGS_STATUS);
+    net_buf_simple_add_le16(&msg, net_buf_simple_pull_le16(buf));
+
+    bt_mesh_model_send(model, ctx, &msg, NULL, NULL);
+}
+
+static void setting_get(struct bt_mesh_model *model, struct bt_mesh_msg_ctx *ctx, struct net_buf_simple *buf)
+{
+    BT_MESH_MODEL_BUF_DEFINE(msg, OP_SETTING_STATUS, 4);
+
+    bt_mesh_model_msg_init(&msg, OP_SETTING_STATUS);
+    net_buf_simple_add_le16(&msg, net_buf_simple_pull_le16(buf));
+    net_buf_simple_add_le16(&msg, net_buf_simple_pull_le16(buf));
+
+    bt_mesh_model_send(model, ctx, &msg, NULL, NULL);
+}
+
+static void setting_set_unack(struct bt_mesh_model *model, struct bt_mesh_msg_ctx *ctx, struct net_buf_simple *buf)
+{
+}
+
+const struct bt_mesh_model_op mesh_sensor_setup_srv_op[] = {
+    { OP_CADENCE_GET, 2, cadence_get },
+    { OP_CADENCE_SET, 2, cadence_set },
+    { OP_CADENCE_SET_UNACK, 2, cadence_set_unack },
+    { OP_SETTINGS_GET, 2, settings_get },
+    { OP_SETTING_GET, 4, setting_get },
+    // Answered like a get, there is no setting to change
+    { OP_SETTING_SET, 4, setting_get },
+    { OP_SETTING_SET_UNACK, 4, setting_set_unack },
+    BT_MESH_MODEL_OP_END,
+};
+
+#if CONFIG_SETTINGS
+
+static int mesh_sensor_settings_set(const char *name, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+    for (int i = 0; i < ARRAY_SIZE(mesh_sensors); i++) {
+        struct mesh_sensor *sensor = mesh_sensors[i];
+        struct mesh_sensor_cadence cadence;
+        const char *next;
+
+        if (!settings_name_steq(name, sensor->settings_name, &next) || next) {
+            continue;
+        }
+
+        if (len != sizeof(cadence)) {
+            LOG_WRN("Ignoring stored %s cadence of the wrong size", sensor->settings_name);
+            return -EINVAL;
+        }
+
+        ssize_t ret = read_cb(cb_arg, &cadence, sizeof(cadence));
+        if (ret < 0) {
+            return ret;
+        }
+
+        k_mutex_lock(&mesh_sensor_lock, K_FOREVER);
+        sensor->cadence = cadence;
+        k_mutex_unlock(&mesh_sensor_lock);
+
+        LOG_DBG("Loaded %s cadence", sensor->settings_name);
+        return 0;
+    }
+
+    return -ENOENT;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(mesh_sensor, "msensor", NULL, mesh_sensor_settings_set, NULL, NULL);
+
+#endif // CONFIG_SETTINGS
+
+static int cmd_mesh_sensor(const struct shell *shell, size_t argc, char **argv)
+{
+    struct bt_mesh_model_pub *pub = &mesh_sensor_srv_pub;
+
+    k_mutex_lock(&mesh_sensor_lock, K_FOREVER);
+
+    for (int i = 0; i < ARRAY_SIZE(mesh_sensors); i++) {
+        const struct mesh_sensor *sensor = mesh_sensors[i];
+        const struct mesh_sensor_cadence *cadence = &sensor->cadence;
+
+        shell_print(shell, "%s (0x%04x): %d, published %d%s", sensor->settings_name, sensor->property_id,
+                    sensor->value, sensor->published, mesh_sensor_fast(sensor) ? ", fast cadence" : "");
+        shell_print(shell, "  divisor %u in %d..%d, deltas -%u/+%u%s, min interval %u ms",
+                    1U << cadence->period_div, cadence->fast_low, cadence->fast_high,
+                    cadence->delta_down, cadence->delta_up,
+                    cadence->trigger_type == TRIGGER_PERCENT ? " (0.01 %)" : "", 1U << cadence->min_interval);
+    }
+
+    shell_print(shell, "Publishing to 0x%04x every %u ms, divided by %u", pub->addr,
+                mesh_sensor_period_ms(pub->period), pub->fast_period ? 1U << pub->period_div : 1U);
+    shell_print(shell, "%u periodic, %u triggered, %u deferred by the min interval",
+                periodic_count, triggered_count, deferred_count);
+
+    k_mutex_unlock(&mesh_sensor_lock);
+
+    return 0;
+}
+
+SHELL_CMD_REGISTER(meshsensor, NULL, "Mesh sensor cadence and publications", cmd_mesh_sensor);
+
+static int mesh_sensor_init(struct device *dev)
+{
+    ARG_UNUSED(dev);
+
+    k_delayed_work_init(&publish_work, mesh_sensor_publish_handler);
+
+    return 0;
+}
+
+SYS_INIT(mesh_sensor_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+#endif // CONFIG_APP_MESH
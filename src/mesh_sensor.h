@@ -0,0 +1,31 @@
+#pragma once
+
+#include <zephyr/types.h>
+#include <bluetooth/mesh.h>
+
+#include "measurement.h"
+
+/**
+ * Mesh Sensor Server and Sensor Setup Server for the temperature (Precise
+ * Present Ambient Temperature) and humidity (Present Ambient Relative
+ * Humidity) properties. Besides the periodic publication configured by
+ * the provisioner, the Sensor Cadence state publishes a reading as soon as
+ * it moves by the delta triggers, at most once per status min interval,
+ * and shortens the period while it is within the fast cadence range.
+ */
+
+extern const struct bt_mesh_model_op mesh_sensor_srv_op[];
+extern const struct bt_mesh_model_op mesh_sensor_setup_srv_op[];
+extern struct bt_mesh_model_pub mesh_sensor_srv_pub;
+extern struct bt_mesh_model_pub mesh_sensor_setup_srv_pub;
+
+/** The sensor models, to be placed in the primary element. */
+#define MESH_SENSOR_MODELS                                                                    \
+    BT_MESH_MODEL(BT_MESH_MODEL_ID_SENSOR_SRV, mesh_sensor_srv_op, &mesh_sensor_srv_pub, NULL), \
+    BT_MESH_MODEL(BT_MESH_MODEL_ID_SENSOR_SETUP_SRV, mesh_sensor_setup_srv_op, &mesh_sensor_setup_srv_pub, NULL)
+
+/** Hand a new reading to the models, publishing it if a delta trigger fires. */
+void mesh_sensor_update(const struct measurement *measurement);
+
+/** Sensor Status messages published so far, periodic and triggered. */
+u32_t mesh_sensor_publication_count(void);
@@ -0,0 +1,266 @@
+#include <zephyr.h>
+#include <init.h>
+#include <string.h>
+#include <errno.h>
+#include <shell/shell.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/gatt.h>
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(notify_queue, LOG_LEVEL_INF);
+
+#include "notify_queue.h"
+
+// One entry per connection and attribute with something to send. Entries are sent oldest first,
+// and a new value for an entry that is still waiting takes its place in line. The stack reports
+// every notification sent through bt_gatt_notify_cb(), which is what moves the queue along, so a
+// burst of updates never waits on ACL buffers in the sampling path.
+
+// Retry interval when the stack is out of buffers for reasons of its own, e.g. a history download
+#define NOTIFY_RETRY_DELAY 100
+
+struct notify_entry {
+    struct bt_conn *conn;
+    const struct bt_gatt_attr *attr;
+    // Order the entry was queued in
+    u32_t seq;
+    u8_t data[NOTIFY_QUEUE_VALUE_MAX];
+    u8_t len;
+    // Waiting to be handed to the stack, and handed to it but not sent yet
+    bool pending;
+    bool in_flight;
+};
+
+static struct notify_entry entries[CONFIG_APP_NOTIFY_QUEUE_SIZE];
+static u32_t next_seq;
+static u8_t in_flight;
+
+static u32_t sent, coalesced, dropped;
+
+static K_MUTEX_DEFINE(notify_lock);
+static struct k_delayed_work drain_work;
+
+static void notify_sent(struct bt_conn *conn, void *user_data)
+{
+    struct notify_entry *entry = user_data;
+
+    k_mutex_lock(&notify_lock, K_FOREVER);
+
+    // The entry may have been released when its connection went down
+    if (entry->in_flight && entry->conn == conn) {
+        entry->in_flight = false;
+        in_flight--;
+        sent++;
+    }
+
+    k_mutex_unlock(&notify_lock);
+
+    k_delayed_work_submit(&drain_work, K_NO_WAIT);
+}
+
+static struct notify_entry *notify_oldest_pending(void)
+{
+    struct notify_entry *oldest = NULL;
+
+    for (int i = 0; i < CONFIG_APP_NOTIFY_QUEUE_SIZE; i++) {
+        struct notify_entry *entry = &entries[i];
+
+        if (entry->pending && !entry->in_flight && (oldest == NULL || (s32_t)(entry->seq - oldest->seq) < 0)) {
+            oldest = entry;
+        }
+    }
+
+    return oldest;
+}
+
+static struct notify_entry *notify_find_pending(struct bt_conn *conn, const struct bt_gatt_attr *attr)
+{
+    for (int i = 0; i < CONFIG_APP_NOTIFY_QUEUE_SIZE; i++) {
+        if (entries[i].pending && entries[i].conn == conn && entries[i].attr == attr) {
+            return &entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void notify_drain_handler(struct k_work *work)
+{
+    // bt_gatt_notify_cb() may wait for buffers, so the lock is only held to pick the entry, leaving
+    // notify_queue_push() free to run meanwhile. An entry in flight isn't touched by anyone else.
+    for (;;) {
+        k_mutex_lock(&notify_lock, K_FOREVER);
+
+        struct notify_entry *entry = in_flight < CONFIG_APP_NOTIFY_QUEUE_IN_FLIGHT ? notify_oldest_pending() : NULL;
+
+        if (entry == NULL) {
+            k_mutex_unlock(&notify_lock);
+            break;
+        }
+
+        struct bt_conn *conn = bt_conn_ref(entry->conn);
+        struct bt_gatt_notify_params params = {
+            .attr = entry->attr,
+            .data = entry->data,
+            .len = entry->len,
+            .func = notify_sent,
+            .user_data = entry,
+        };
+
+        entry->pending = false;
+        entry->in_flight = true;
+        in_flight++;
+
+        k_mutex_unlock(&notify_lock);
+
+        int err = bt_gatt_notify_cb(conn, &params);
+
+        k_mutex_lock(&notify_lock, K_FOREVER);
+
+        // A disconnect meanwhile has released the entry already
+        if (err && entry->in_flight && entry->conn == conn) {
+            entry->in_flight = false;
+            in_flight--;
+
+            if (err == -ENOMEM && notify_find_pending(conn, entry->attr) != NULL) {
+                // A newer value was queued meanwhile and goes out instead
+                coalesced++;
+            } else if (err == -ENOMEM) {
+                // Out of buffers, try again once a notification in flight is done
+                entry->pending = true;
+            } else {
+                LOG_DBG("Notification dropped (Error %d)", err);
+                dropped++;
+            }
+        }
+
+        if (err == -ENOMEM && in_flight == 0) {
+            k_delayed_work_submit(&drain_work, NOTIFY_RETRY_DELAY);
+        }
+
+        k_mutex_unlock(&notify_lock);
+        bt_conn_unref(conn);
+
+        if (err == -ENOMEM) {
+            break;
+        }
+    }
+}
+
+int notify_queue_push(struct bt_conn *conn, const struct bt_gatt_attr *attr, const void *data, u16_t len)
+{
+    struct notify_entry *entry = NULL;
+    struct notify_entry *free_entry = NULL;
+    int ret = 0;
+
+    if (len > NOTIFY_QUEUE_VALUE_MAX) {
+        return -EINVAL;
+    }
+
+    k_mutex_lock(&notify_lock, K_FOREVER);
+
+    for (int i = 0; i < CONFIG_APP_NOTIFY_QUEUE_SIZE; i++) {
+        if (entries[i].pending && entries[i].conn == conn && entries[i].attr == attr) {
+            entry = &entries[i];
+        } else if (free_entry == NULL && !entries[i].pending && !entries[i].in_flight) {
+            free_entry = &entries[i];
+        }
+    }
+
+    if (entry != NULL) {
+        coalesced++;
+    } else {
+        // A value in flight for the same attribute keeps its entry until it has been sent
+        entry = free_entry;
+
+        if (entry == NULL) {
+            dropped++;
+            ret = -ENOMEM;
+        } else {
+            entry->conn = conn;
+            entry->attr = attr;
+            entry->seq = next_seq++;
+            entry->pending = true;
+        }
+    }
+
+    if (entry != NULL) {
+        memcpy(entry->data, data, len);
+        entry->len = len;
+    }
+
+    k_mutex_unlock(&notify_lock);
+
+    if (ret == 0) {
+        k_delayed_work_submit(&drain_work, K_NO_WAIT);
+    } else {
+        LOG_WRN("Notification queue full, value dropped");
+    }
+
+    return ret;
+}
+
+static void notify_disconnected(struct bt_conn *conn, u8_t reason)
+{
+    k_mutex_lock(&notify_lock, K_FOREVER);
+
+    for (int i = 0; i < CONFIG_APP_NOTIFY_QUEUE_SIZE; i++) {
+        struct notify_entry *entry = &entries[i];
+
+        if (entry->conn != conn) {
+            continue;
+        }
+
+        if (entry->pending) {
+            dropped++;
+        }
+        if (entry->in_flight) {
+            in_flight--;
+        }
+
+        entry->conn = NULL;
+        entry->attr = NULL;
+        entry->pending = false;
+        entry->in_flight = false;
+    }
+
+    k_mutex_unlock(&notify_lock);
+}
+
+static struct bt_conn_cb notify_connection_callbacks = {
+    .disconnected = notify_disconnected,
+};
+
+static int cmd_notify(const struct shell *shell, size_t argc, char **argv)
+{
+    k_mutex_lock(&notify_lock, K_FOREVER);
+
+    u8_t pending = 0;
+
+    for (int i = 0; i < CONFIG_APP_NOTIFY_QUEUE_SIZE; i++) {
+        pending += entries[i].pending;
+    }
+
+    shell_print(shell, "%u sent, %u coalesced, %u dropped, %u queued, %u in flight",
+                sent, coalesced, dropped, pending, in_flight);
+
+    k_mutex_unlock(&notify_lock);
+
+    return 0;
+}
+
+SHELL_CMD_REGISTER(notify, NULL, "Notification queue counters", cmd_notify);
+
+static int notify_queue_init(struct device *dev)
+{
+    ARG_UNUSED(dev);
+
+    k_delayed_work_init(&drain_work, notify_drain_handler);
+    bt_conn_cb_register(&notify_connection_callbacks);
+
+    return 0;
+}
+
+SYS_INIT(notify_queue_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
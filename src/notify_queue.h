@@ -0,0 +1,20 @@
+#pragma once
+
+#include <zephyr/types.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/gatt.h>
+
+// Largest value the queue holds
+#define NOTIFY_QUEUE_VALUE_MAX 4
+
+/**
+ * Queue a notification of @p attr to @p conn without blocking. A value
+ * still waiting for the same connection and attribute is replaced, so only
+ * the latest one is sent. The queue is drained on the system work queue,
+ * keeping at most CONFIG_APP_NOTIFY_QUEUE_IN_FLIGHT notifications in the
+ * stack.
+ *
+ * @return 0 if queued, -ENOMEM if the queue is full and the value was
+ * dropped.
+ */
+int notify_queue_push(struct bt_conn *conn, const struct bt_gatt_attr *attr, const void *data, u16_t len);
@@ -0,0 +1,82 @@
+#include <zephyr.h>
+#include <stdlib.h>
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(sampling, LOG_LEVEL_INF);
+
+#include "sampling.h"
+
+struct sampling_channel {
+    const char *name;
+    // Rate of change (hundredths per minute) above which the value is considered moving
+    s32_t threshold;
+    s32_t last;
+};
+
+static struct sampling_channel channels[] = {
+    { .name = "temperature", .threshold = CONFIG_APP_SAMPLING_TEMPERATURE_THRESHOLD },
+    { .name = "humidity", .threshold = CONFIG_APP_SAMPLING_HUMIDITY_THRESHOLD },
+};
+
+static u32_t period = CONFIG_APP_SAMPLING_PERIOD_MIN;
+static bool have_last = false;
+static s64_t last_time;
+
+static bool sampling_channel_moving(struct sampling_channel *channel, s32_t value, s32_t elapsed)
+{
+    // Scale the change since the last sample to a rate per minute
+    s32_t rate = abs(value - channel->last) * 60000 / elapsed;
+
+    channel->last = value;
+
+    if (rate > channel->threshold) {
+        LOG_DBG("%s changing at %d/min", channel->name, rate);
+        return true;
+    }
+
+    return false;
+}
+
+u32_t sampling_update(s32_t temperature, s32_t humidity)
+{
+    u32_t old_period = period;
+    bool moving = false;
+    s64_t now = k_uptime_get();
+
+    if (have_last) {
+        // The button can wake the loop early, so use the real time between samples
+        s32_t elapsed = MAX(now - last_time, 1);
+
+        // Evaluate every channel so each one keeps its last value up to date
+        moving |= sampling_channel_moving(&channels[0], temperature, elapsed);
+        moving |= sampling_channel_moving(&channels[1], humidity, elapsed);
+    } else {
+        channels[0].last = temperature;
+        channels[1].last = humidity;
+        have_last = true;
+    }
+
+    last_time = now;
+
+    if (moving) {
+        period = CONFIG_APP_SAMPLING_PERIOD_MIN;
+    } else {
+        period = MIN(period * 2, CONFIG_APP_SAMPLING_PERIOD_MAX);
+    }
+
+    if (period != old_period) {
+        LOG_INF("Sampling every %u s", period);
+    }
+
+    return period;
+}
+
+u32_t sampling_period(void)
+{
+    return period;
+}
+
+void sampling_boost(void)
+{
+    period = CONFIG_APP_SAMPLING_PERIOD_MIN;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <zephyr/types.h>
+
+/**
+ * Feed the latest readings (in hundredths of a unit) to the scheduler.
+ *
+ * While either channel changes faster than its threshold the fastest
+ * period is used, otherwise the period doubles on every flat reading up to
+ * CONFIG_APP_SAMPLING_PERIOD_MAX.
+ *
+ * @return the number of seconds until the next sample should be taken.
+ */
+u32_t sampling_update(s32_t temperature, s32_t humidity);
+
+/** Current sampling period in seconds. */
+u32_t sampling_period(void);
+
+/** Go back to the fastest sampling period, e.g. after user interaction. */
+void sampling_boost(void);
@@ -1,44 +1,227 @@
 #include <zephyr.h>
+#include <stdlib.h>
 #include <device.h>
 #include <init.h>
-#include <drivers/sensor.h>
+#include <drivers/i2c.h>
+#include <sys/byteorder.h>
+#include <shell/shell.h>
 
 #include <logging/log.h>
 LOG_MODULE_REGISTER(sensor, LOG_LEVEL_INF);
 
-struct device *dev_sensor = NULL;
+#include "sensor.h"
 
-int update_sensor(struct sensor_value *temp, struct sensor_value *hum)
+// The SHT3x is driven directly rather than through Zephyr's sht3xd driver, as that driver busy waits
+// through single shot measurements and only lets the periodic rate be chosen at build time.
+
+#define SHT3X_CMD_FETCH         0xE000
+#define SHT3X_CMD_BREAK         0x3093
+
+// Single shot measurement without clock stretching, indexed by repeatability
+static const u16_t sht3x_single_shot_cmd[] = { 0x2416, 0x240B, 0x2400 };
+
+// Maximum measurement duration (ms), indexed by repeatability
+static const u8_t sht3x_measure_time[] = { 5, 7, 16 };
+
+// Periodic measurement commands, indexed by rate and repeatability
+static const u16_t sht3x_periodic_cmd[][3] = {
+    [SENSOR_MODE_PERIODIC_0_5_MPS] = { 0x202F, 0x2024, 0x2032 },
+    [SENSOR_MODE_PERIODIC_1_MPS] = { 0x212D, 0x2126, 0x2130 },
+    [SENSOR_MODE_PERIODIC_2_MPS] = { 0x222B, 0x2220, 0x2236 },
+    [SENSOR_MODE_PERIODIC_4_MPS] = { 0x2329, 0x2322, 0x2334 },
+    [SENSOR_MODE_PERIODIC_10_MPS] = { 0x272A, 0x2721, 0x2737 },
+};
+
+#if defined(CONFIG_APP_SENSOR_MODE_PERIODIC_0_5_MPS)
+#define SENSOR_DEFAULT_MODE SENSOR_MODE_PERIODIC_0_5_MPS
+#elif defined(CONFIG_APP_SENSOR_MODE_PERIODIC_1_MPS)
+#define SENSOR_DEFAULT_MODE SENSOR_MODE_PERIODIC_1_MPS
+#elif defined(CONFIG_APP_SENSOR_MODE_PERIODIC_2_MPS)
+#define SENSOR_DEFAULT_MODE SENSOR_MODE_PERIODIC_2_MPS
+#elif defined(CONFIG_APP_SENSOR_MODE_PERIODIC_4_MPS)
+#define SENSOR_DEFAULT_MODE SENSOR_MODE_PERIODIC_4_MPS
+#elif defined(CONFIG_APP_SENSOR_MODE_PERIODIC_10_MPS)
+#define SENSOR_DEFAULT_MODE SENSOR_MODE_PERIODIC_10_MPS
+#else
+#define SENSOR_DEFAULT_MODE SENSOR_MODE_SINGLE_SHOT
+#endif
+
+#if defined(CONFIG_APP_SENSOR_REPEATABILITY_LOW)
+#define SENSOR_DEFAULT_REPEATABILITY SENSOR_REPEATABILITY_LOW
+#elif defined(CONFIG_APP_SENSOR_REPEATABILITY_MEDIUM)
+#define SENSOR_DEFAULT_REPEATABILITY SENSOR_REPEATABILITY_MEDIUM
+#else
+#define SENSOR_DEFAULT_REPEATABILITY SENSOR_REPEATABILITY_HIGH
+#endif
+
+static struct device *dev_i2c = NULL;
+
+static enum sensor_mode mode = SENSOR_MODE_SINGLE_SHOT;
+static enum sensor_repeatability repeatability = SENSOR_REPEATABILITY_HIGH;
+
+// Single shot measurement in progress, and when its result is available
+static bool measuring = false;
+static s64_t ready_at;
+
+static int sht3x_write_command(u16_t cmd)
 {
-    if(dev_sensor == NULL)
-    {
-        return -ENOENT;
+    u8_t buf[2];
+
+    sys_put_be16(cmd, buf);
+
+    return i2c_write(dev_i2c, buf, sizeof(buf), DT_ALIAS_SENSOR0_BASE_ADDRESS);
+}
+
+static u8_t sht3x_crc(const u8_t *data, size_t len)
+{
+    u8_t crc = 0xFF;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : (crc << 1);
+        }
     }
 
-    LOG_DBG("Fetching sensor data");
-    int ret = sensor_sample_fetch(dev_sensor);
-    if (ret)
-    {
-        LOG_ERR("Could not get fetch sample from %s, errno: %d", dev_sensor->config->name, ret);
+    return crc;
+}
+
+static int sht3x_read_result(u16_t *t_sample, u16_t *rh_sample)
+{
+    u8_t rx[6];
+    int ret;
+
+    // Without clock stretching the SHT3x NACKs the read until the result is ready
+    ret = i2c_read(dev_i2c, rx, sizeof(rx), DT_ALIAS_SENSOR0_BASE_ADDRESS);
+    if (ret) {
         return ret;
     }
 
-    LOG_DBG("Getting SENSOR_CHAN_AMBIENT_TEMP");
-    ret = sensor_channel_get(dev_sensor, SENSOR_CHAN_AMBIENT_TEMP, temp);
-    if (ret)
-    {
-        LOG_ERR("Could not get SENSOR_CHAN_AMBIENT_TEMP from %s, errno: %d", dev_sensor->config->name, ret);
+    if (sht3x_crc(&rx[0], 2) != rx[2] || sht3x_crc(&rx[3], 2) != rx[5]) {
+        LOG_ERR("Received invalid data from the SHT3x");
+        return -EIO;
+    }
+
+    *t_sample = sys_get_be16(&rx[0]);
+    *rh_sample = sys_get_be16(&rx[3]);
+
+    return 0;
+}
+
+int sensor_set_mode(enum sensor_mode new_mode, enum sensor_repeatability new_repeatability)
+{
+    int ret;
+
+    if (dev_i2c == NULL) {
+        return -ENOENT;
+    }
+
+    if (new_mode > SENSOR_MODE_PERIODIC_10_MPS || new_repeatability > SENSOR_REPEATABILITY_HIGH) {
+        return -EINVAL;
+    }
+
+    // Periodic measurements have to be stopped before another command is accepted
+    if (mode != SENSOR_MODE_SINGLE_SHOT) {
+        ret = sht3x_write_command(SHT3X_CMD_BREAK);
+        if (ret) {
+            LOG_ERR("Could not stop periodic measurements, errno: %d", ret);
+            return ret;
+        }
+        k_sleep(1);
+    }
+
+    measuring = false;
+    mode = new_mode;
+    repeatability = new_repeatability;
+
+    if (mode != SENSOR_MODE_SINGLE_SHOT) {
+        ret = sht3x_write_command(sht3x_periodic_cmd[mode][repeatability]);
+        if (ret) {
+            LOG_ERR("Could not start periodic measurements, errno: %d", ret);
+            mode = SENSOR_MODE_SINGLE_SHOT;
+            return ret;
+        }
+    }
+
+    LOG_DBG("Sensor mode %d, repeatability %d", mode, repeatability);
+
+    return 0;
+}
+
+int sensor_measure_start(void)
+{
+    int ret;
+
+    if (dev_i2c == NULL) {
+        return -ENOENT;
+    }
+
+    if (mode != SENSOR_MODE_SINGLE_SHOT || measuring) {
+        return 0;
+    }
+
+    ret = sht3x_write_command(sht3x_single_shot_cmd[repeatability]);
+    if (ret) {
+        LOG_ERR("Could not start measurement, errno: %d", ret);
         return ret;
     }
 
-    LOG_DBG("Getting SENSOR_CHAN_HUMIDITY");
-    ret = sensor_channel_get(dev_sensor, SENSOR_CHAN_HUMIDITY, hum);
-    if(ret)
+    measuring = true;
+    ready_at = k_uptime_get() + sht3x_measure_time[repeatability];
+
+    return 0;
+}
+
+static void sensor_convert(u16_t t_sample, u16_t rh_sample, struct measurement *result)
+{
+    // T = -45 + 175 * sample / (2^16 - 1), in hundredths. Dividing by 2^16 instead is at most
+    // 0.01 off, and turns the division the M0 doesn't have into a shift.
+    result->temperature = (s16_t)((((u32_t)t_sample * 17500U) + 0x8000U) >> 16) - 4500;
+
+    // RH = 100 * sample / (2^16 - 1), in hundredths
+    result->humidity = (((u32_t)rh_sample * 10000U) + 0x8000U) >> 16;
+}
+
+int update_sensor(struct measurement *result)
+{
+    u16_t t_sample, rh_sample;
+    int ret;
+
+    if(dev_i2c == NULL)
     {
-        LOG_ERR("Could not get SENSOR_CHAN_HUMIDITY from %s, errno: %d", dev_sensor->config->name, ret);
+        return -ENOENT;
+    }
+
+    if (mode == SENSOR_MODE_SINGLE_SHOT) {
+        ret = sensor_measure_start();
+        if (ret) {
+            return ret;
+        }
+
+        // Sleep through whatever is left of the conversion
+        s64_t remaining = ready_at - k_uptime_get();
+        if (remaining > 0) {
+            k_sleep(remaining);
+        }
+
+        measuring = false;
+    } else {
+        LOG_DBG("Fetching periodic measurement");
+        ret = sht3x_write_command(SHT3X_CMD_FETCH);
+        if (ret) {
+            LOG_ERR("Could not fetch measurement, errno: %d", ret);
+            return ret;
+        }
+    }
+
+    ret = sht3x_read_result(&t_sample, &rh_sample);
+    if (ret) {
+        LOG_ERR("Could not read measurement, errno: %d", ret);
         return ret;
     }
 
+    sensor_convert(t_sample, rh_sample, result);
+
     LOG_DBG("Sensor updated");
 
     return 0;
@@ -48,12 +231,103 @@ static int sensor_init(struct device *dev)
 {
     ARG_UNUSED(dev);
 
-    dev_sensor = device_get_binding(DT_ALIAS_SENSOR0_LABEL);
-    if (dev_sensor == NULL) {
-        LOG_ERR("Didn't find %s device", DT_ALIAS_SENSOR0_LABEL);
+    dev_i2c = device_get_binding(DT_ALIAS_SENSOR0_BUS_NAME);
+    if (dev_i2c == NULL) {
+        LOG_ERR("Didn't find %s device", DT_ALIAS_SENSOR0_BUS_NAME);
+        return 0;
     }
 
+    // The SHT3x keeps measuring periodically across an MCU reset, make sure it's idle first
+    sht3x_write_command(SHT3X_CMD_BREAK);
+    k_sleep(1);
+
+    sensor_set_mode(SENSOR_DEFAULT_MODE, SENSOR_DEFAULT_REPEATABILITY);
+
     return 0;
 }
 
 SYS_INIT(sensor_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+#if defined(CONFIG_APP_SENSOR_BENCHMARK)
+
+// The conversion chain used before readings were kept in hundredths: sensor_value from the
+// driver, digits for the display and hundredths for ESS, all through (64 bit) divisions.
+static void sensor_convert_legacy(u16_t t_sample, u16_t rh_sample, u8_t digits[6], s16_t *temp_centi, u16_t *hum_centi)
+{
+    s32_t val1, val2;
+
+    u64_t tmp = (u64_t)t_sample * 175U;
+    val1 = (s32_t)(tmp / 0xFFFF) - 45;
+    val2 = ((tmp % 0xFFFF) * 1000000U) / 0xFFFF;
+    digits[0] = val1 / 10;
+    digits[1] = val1 % 10;
+    digits[2] = val2 / 100000;
+    *temp_centi = (val1 * 100) + (val2 / 10000);
+
+    tmp = (u64_t)rh_sample * 100U;
+    val1 = tmp / 0xFFFF;
+    val2 = ((tmp % 0xFFFF) * 1000000U) / 0xFFFF;
+    digits[3] = val1 / 10;
+    digits[4] = val1 % 10;
+    digits[5] = val2 / 100000;
+    *hum_centi = (val1 * 100) + (val2 / 10000);
+}
+
+static void sensor_convert_centi(u16_t t_sample, u16_t rh_sample, u8_t digits[6], s16_t *temp_centi, u16_t *hum_centi)
+{
+    struct measurement result;
+
+    sensor_convert(t_sample, rh_sample, &result);
+    measurement_digits(result.temperature, &digits[0]);
+    measurement_digits(result.humidity, &digits[3]);
+    *temp_centi = result.temperature;
+    *hum_centi = result.humidity;
+}
+
+// Results go somewhere the compiler can't see through, so the conversions aren't optimised away
+static volatile s32_t sensor_bench_sink;
+
+static u32_t sensor_bench_run(void (*convert)(u16_t, u16_t, u8_t *, s16_t *, u16_t *), u32_t iterations)
+{
+    u8_t digits[6];
+    s16_t t;
+    u16_t h;
+
+    u32_t start = k_cycle_get_32();
+
+    for (u32_t i = 0; i < iterations; i++) {
+        // Sweep samples that stay on the displayable 0-99.9 range
+        u16_t sample = 0x6000 + (u16_t)(i * 7);
+
+        convert(sample, sample, digits, &t, &h);
+        sensor_bench_sink = t + h + digits[0] + digits[3];
+    }
+
+    return k_cycle_get_32() - start;
+}
+
+static int cmd_sensor_bench(const struct shell *shell, size_t argc, char **argv)
+{
+    u32_t iterations = 1000;
+
+    if (argc > 1) {
+        iterations = strtoul(argv[1], NULL, 0);
+        if (iterations == 0) {
+            shell_error(shell, "Invalid iteration count: %s", argv[1]);
+            return -EINVAL;
+        }
+    }
+
+    u32_t legacy = sensor_bench_run(sensor_convert_legacy, iterations);
+    u32_t centi = sensor_bench_run(sensor_convert_centi, iterations);
+
+    shell_print(shell, "%u conversions, cycles per conversion:", iterations);
+    shell_print(shell, "  sensor_value: %u", legacy / iterations);
+    shell_print(shell, "  centi:        %u", centi / iterations);
+
+    return 0;
+}
+
+SHELL_CMD_ARG_REGISTER(sensor_bench, NULL, "Compare conversion cost [iterations]", cmd_sensor_bench, 1, 1);
+
+#endif // CONFIG_APP_SENSOR_BENCHMARK
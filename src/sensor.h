@@ -1,6 +1,37 @@
 #ifndef _APPLICATION_SENSOR_H_
 #define _APPLICATION_SENSOR_H_
 
-int update_sensor(struct sensor_value *temp, struct sensor_value *hum);
+#include "measurement.h"
+
+enum sensor_mode {
+    // Measure on request with sensor_measure_start()/update_sensor()
+    SENSOR_MODE_SINGLE_SHOT,
+    // The SHT3x measures on its own, update_sensor() only reads out the latest result
+    SENSOR_MODE_PERIODIC_0_5_MPS,
+    SENSOR_MODE_PERIODIC_1_MPS,
+    SENSOR_MODE_PERIODIC_2_MPS,
+    SENSOR_MODE_PERIODIC_4_MPS,
+    SENSOR_MODE_PERIODIC_10_MPS,
+};
+
+// Higher repeatability means less noise but a longer (and more power hungry) measurement
+enum sensor_repeatability {
+    SENSOR_REPEATABILITY_LOW,
+    SENSOR_REPEATABILITY_MEDIUM,
+    SENSOR_REPEATABILITY_HIGH,
+};
+
+/** Change the SHT3x acquisition mode and measurement repeatability. */
+int sensor_set_mode(enum sensor_mode mode, enum sensor_repeatability repeatability);
+
+/**
+ * Start a single shot measurement, so the conversion runs while other work
+ * is done. update_sensor() then only waits for what's left of it. Does
+ * nothing in periodic mode.
+ */
+int sensor_measure_start(void);
+
+/** Read the latest temperature and humidity into @p result. */
+int update_sensor(struct measurement *result);
 
 #endif // _APPLICATION_SENSOR_H_
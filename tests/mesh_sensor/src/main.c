@@ -0,0 +1,275 @@
+#include <ztest.h>
+#include <string.h>
+
+#include <bluetooth/mesh.h>
+
+#include "mesh_sensor.h"
+
+// The access layer is replaced by the stubs below, which keep the last message sent and published,
+// so the models run without a mesh stack. Messages are handed straight to the opcode handlers.
+// The tests run in order and build on the state left by the previous ones.
+
+static struct bt_mesh_model models[] = {
+    MESH_SENSOR_MODELS,
+};
+
+#define MODEL_SRV   (&models[0])
+#define MODEL_SETUP (&models[1])
+
+// Entries of mesh_sensor_srv_op[] and mesh_sensor_setup_srv_op[]
+#define OP_SENSOR_GET   (&mesh_sensor_srv_op[1])
+#define OP_CADENCE_GET  (&mesh_sensor_setup_srv_op[0])
+#define OP_CADENCE_SET  (&mesh_sensor_setup_srv_op[1])
+
+// Time for the publish work to run
+#define PUBLISH_WAIT K_MSEC(10)
+
+struct message {
+    u8_t data[32];
+    u16_t len;
+    u32_t count;
+};
+
+static struct message sent, published;
+
+static void message_keep(struct message *message, const struct net_buf_simple *msg)
+{
+    zassert_true(msg->len <= sizeof(message->data), "Message of %u bytes", msg->len);
+
+    memcpy(message->data, msg->data, msg->len);
+    message->len = msg->len;
+    message->count++;
+}
+
+void bt_mesh_model_msg_init(struct net_buf_simple *msg, u32_t opcode)
+{
+    net_buf_simple_init(msg, 0);
+
+    if (opcode <= 0xff) {
+        net_buf_simple_add_u8(msg, opcode);
+    } else {
+        net_buf_simple_add_be16(msg, opcode);
+    }
+}
+
+int bt_mesh_model_send(struct bt_mesh_model *model, struct bt_mesh_msg_ctx *ctx, struct net_buf_simple *msg,
+                       const struct bt_mesh_send_cb *cb, void *cb_data)
+{
+    message_keep(&sent, msg);
+    return 0;
+}
+
+int bt_mesh_model_publish(struct bt_mesh_model *model)
+{
+    message_keep(&published, model->pub->msg);
+    return 0;
+}
+
+static void receive(struct bt_mesh_model *model, const struct bt_mesh_model_op *op, const u8_t *data, u16_t len)
+{
+    struct bt_mesh_msg_ctx ctx = { .addr = 0x0001 };
+    NET_BUF_SIMPLE_DEFINE(buf, 16);
+
+    if (len > 0) {
+        net_buf_simple_add_mem(&buf, data, len);
+    }
+    op->func(model, &ctx, &buf);
+}
+
+static void assert_message(const struct message *message, const u8_t *expected, u16_t len)
+{
+    zassert_equal(message->len, len, "Message of %u bytes, expected %u", message->len, len);
+    zassert_mem_equal(message->data, expected, len, "Unexpected message contents");
+}
+
+static void update(s16_t temperature, u16_t humidity)
+{
+    struct measurement measurement = {
+        .temperature = temperature,
+        .humidity = humidity,
+        .battery = 100,
+    };
+
+    mesh_sensor_update(&measurement);
+    k_sleep(PUBLISH_WAIT);
+}
+
+static void test_sensor_get(void)
+{
+    static const u8_t unknown_property[] = { 0x34, 0x12 };
+    static const u8_t unknown_values[] = {
+        0x52,
+        0xa2, 0x0e, 0x00, 0x80,     // Temperature (0x0075) not known
+        0xc2, 0x0e, 0xff, 0xff,     // Humidity (0x0076) not known
+    };
+    static const u8_t no_property[] = {
+        0x52,
+        0xff, 0x34, 0x12,           // Format B without a value
+    };
+
+    receive(MODEL_SRV, OP_SENSOR_GET, NULL, 0);
+    assert_message(&sent, unknown_values, sizeof(unknown_values));
+
+    receive(MODEL_SRV, OP_SENSOR_GET, unknown_property, sizeof(unknown_property));
+    assert_message(&sent, no_property, sizeof(no_property));
+}
+
+static const u8_t cadence_set[] = {
+    0x75, 0x00,     // Precise Present Ambient Temperature
+    0x02,           // Fast cadence period divisor 4, trigger delta as a value
+    0x32, 0x00,     // Delta down 0.50 degC
+    0x64, 0x00,     // Delta up 1.00 degC
+    0x0a,           // Status min interval 1024 ms
+    0xd0, 0x07,     // Fast cadence low 20.00 degC
+    0xc4, 0x09,     // Fast cadence high 25.00 degC
+};
+
+static void test_cadence_set(void)
+{
+    u8_t status[1 + sizeof(cadence_set)] = { 0x57 };
+    u32_t count = sent.count;
+
+    memcpy(&status[1], cadence_set, sizeof(cadence_set));
+
+    receive(MODEL_SETUP, OP_CADENCE_SET, cadence_set, sizeof(cadence_set));
+    zassert_equal(sent.count, count + 1, "No Sensor Cadence Status");
+    assert_message(&sent, status, sizeof(status));
+
+    receive(MODEL_SETUP, OP_CADENCE_GET, cadence_set, 2);
+    assert_message(&sent, status, sizeof(status));
+}
+
+static void test_cadence_set_wrong_size(void)
+{
+    u8_t status[1 + sizeof(cadence_set)] = { 0x57 };
+    u8_t truncated[sizeof(cadence_set) - 1];
+    u32_t count = sent.count;
+
+    memcpy(&status[1], cadence_set, sizeof(cadence_set));
+    memcpy(truncated, cadence_set, sizeof(truncated));
+    // Would allow every reading to be published at once, if it were taken
+    truncated[7] = 0x00;
+
+    receive(MODEL_SETUP, OP_CADENCE_SET, truncated, sizeof(truncated));
+    zassert_equal(sent.count, count, "Answered a Sensor Cadence Set of the wrong size");
+
+    receive(MODEL_SETUP, OP_CADENCE_GET, cadence_set, 2);
+    assert_message(&sent, status, sizeof(status));
+}
+
+static void test_cadence_unknown_property(void)
+{
+    static const u8_t get[] = { 0x34, 0x12 };
+    static const u8_t status[] = { 0x57, 0x34, 0x12 };
+
+    receive(MODEL_SETUP, OP_CADENCE_GET, get, sizeof(get));
+    assert_message(&sent, status, sizeof(status));
+}
+
+static void test_delta_trigger(void)
+{
+    static const u8_t temperature_cadence[] = {
+        0x75, 0x00, 0x00, 0x32, 0x00, 0x32, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00,
+    };
+    static const u8_t humidity_cadence[] = {
+        0x76, 0x00, 0x00, 0xc8, 0x00, 0xc8, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00,
+    };
+    static const u8_t first[] = { 0x52, 0xa2, 0x0e, 0x66, 0x08, 0xc2, 0x0e, 0x88, 0x13 };
+    static const u8_t temperature_down[] = { 0x52, 0xa2, 0x0e, 0x34, 0x08 };
+    u32_t count;
+
+    // Deltas of 0.50 degC and 2.00 %RH, at most every 128 ms
+    receive(MODEL_SETUP, OP_CADENCE_SET, temperature_cadence, sizeof(temperature_cadence));
+    receive(MODEL_SETUP, OP_CADENCE_SET, humidity_cadence, sizeof(humidity_cadence));
+
+    // The first reading is always published
+    count = published.count;
+    update(2150, 5000);
+    zassert_equal(published.count, count + 1, "First reading not published");
+    assert_message(&published, first, sizeof(first));
+
+    k_sleep(K_MSEC(200));
+
+    // Below both deltas
+    count = published.count;
+    update(2170, 5100);
+    zassert_equal(published.count, count, "Published below the deltas");
+
+    // Only the temperature reaches its delta, against the value published last
+    update(2100, 5100);
+    zassert_equal(published.count, count + 1, "Delta down not published");
+    assert_message(&published, temperature_down, sizeof(temperature_down));
+}
+
+static void test_min_interval(void)
+{
+    static const u8_t deferred[] = { 0x52, 0xa2, 0x0e, 0xd0, 0x07 };
+    u32_t count = published.count;
+
+    // Within 128 ms of the last publication
+    update(2000, 5100);
+    zassert_equal(published.count, count, "Published within the status min interval");
+
+    k_sleep(K_MSEC(200));
+    zassert_equal(published.count, count + 1, "Deferred reading not published");
+    assert_message(&published, deferred, sizeof(deferred));
+}
+
+static void test_fast_cadence(void)
+{
+    static const u8_t cadence_slow[] = {
+        0x75, 0x00, 0x02, 0x32, 0x00, 0x32, 0x00, 0x0c, 0xd0, 0x07, 0xc4, 0x09,
+    };
+    struct bt_mesh_model_pub *pub = &mesh_sensor_srv_pub;
+
+    // Every 10 s
+    pub->period = 0x4a;
+
+    // 20.00 degC is within 20.00..25.00, but dividing by 4 would publish more often than every
+    // 4096 ms, so it's only divided by 2
+    receive(MODEL_SETUP, OP_CADENCE_SET, cadence_slow, sizeof(cadence_slow));
+    zassert_true(pub->fast_period, "Fast cadence not applied");
+    zassert_equal(pub->period_div, 1, "Period divided by %u", 1U << pub->period_div);
+
+    // A status min interval of 1024 ms allows the full divisor
+    receive(MODEL_SETUP, OP_CADENCE_SET, cadence_set, sizeof(cadence_set));
+    zassert_true(pub->fast_period, "Fast cadence not applied");
+    zassert_equal(pub->period_div, 2, "Period divided by %u", 1U << pub->period_div);
+
+    update(3000, 5100);
+    zassert_false(pub->fast_period, "Fast cadence outside of its range");
+    zassert_equal(pub->period_div, 0, "Period divided by %u", 1U << pub->period_div);
+
+    // Let the triggered publication held back by the min interval go out
+    k_sleep(K_MSEC(1100));
+}
+
+static void test_periodic_publication(void)
+{
+    static const u8_t status[] = { 0x52, 0xa2, 0x0e, 0xb8, 0x0b, 0xc2, 0x0e, 0xec, 0x13 };
+    struct bt_mesh_model_pub *pub = &mesh_sensor_srv_pub;
+    u32_t count = mesh_sensor_publication_count();
+
+    zassert_equal(pub->update(MODEL_SRV), 0, "Nothing to publish");
+    zassert_equal(pub->msg->len, sizeof(status), "Message of %u bytes", pub->msg->len);
+    zassert_mem_equal(pub->msg->data, status, sizeof(status), "Unexpected message contents");
+    zassert_equal(mesh_sensor_publication_count(), count + 1, "Publication not counted");
+}
+
+void test_main(void)
+{
+    mesh_sensor_srv_pub.mod = MODEL_SRV;
+    mesh_sensor_srv_pub.addr = 0xc000;
+    mesh_sensor_setup_srv_pub.mod = MODEL_SETUP;
+
+    ztest_test_suite(mesh_sensor,
+                     ztest_unit_test(test_sensor_get),
+                     ztest_unit_test(test_cadence_set),
+                     ztest_unit_test(test_cadence_set_wrong_size),
+                     ztest_unit_test(test_cadence_unknown_property),
+                     ztest_unit_test(test_delta_trigger),
+                     ztest_unit_test(test_min_interval),
+                     ztest_unit_test(test_fast_cadence),
+                     ztest_unit_test(test_periodic_publication));
+    ztest_run_test_suite(mesh_sensor);
+}